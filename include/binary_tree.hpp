@@ -0,0 +1,205 @@
+#ifndef _BINARY_TREE_H
+#define _BINARY_TREE_H
+
+#include "digraph.hpp"
+
+#include <array>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+/*
+  Array backed rooted binary tree. Vertices are indexed 0, ..., n - 1
+  and the topology is stored as parent/left/right index arrays, so
+  every structural query and NNI swap is O(1) with no allocation.
+*/
+template <class T>
+class binary_tree {
+private:
+    std::vector<int> parent_;
+    std::vector<int> left_;
+    std::vector<int> right_;
+    std::vector<T> data_;
+
+public:
+    static constexpr int none = -1;
+
+    // returns id of created vertex
+    int add_vertex(T data) {
+        parent_.push_back(none);
+        left_.push_back(none);
+        right_.push_back(none);
+        data_.push_back(std::move(data));
+        return data_.size() - 1;
+    }
+
+    void add_edge(int u, int v) {
+        if (parent_[v] != none) {
+            throw std::logic_error("vertex already has a parent");
+        }
+
+        if (left_[u] == none) {
+            left_[u] = v;
+        } else if (right_[u] == none) {
+            right_[u] = v;
+        } else {
+            throw std::logic_error("vertex already has two children");
+        }
+
+        parent_[v] = u;
+    }
+
+    size_t size() const {
+        return data_.size();
+    }
+
+    T& operator[](int u) {
+        return data_[u];
+    }
+
+    const T& operator[](int u) const {
+        return data_[u];
+    }
+
+    int parent(int u) const {
+        return parent_[u];
+    }
+
+    int left(int u) const {
+        return left_[u];
+    }
+
+    int right(int u) const {
+        return right_[u];
+    }
+
+    bool is_leaf(int u) const {
+        return left_[u] == none;
+    }
+
+    size_t out_degree(int u) const {
+        return (left_[u] != none) + (right_[u] != none);
+    }
+
+    /*
+      Returns the children of an internal vertex in increasing
+      order of id, i.e. the order of digraph::successors.
+    */
+    std::array<int, 2> children(int u) const {
+        if (left_[u] < right_[u]) return {left_[u], right_[u]};
+        return {right_[u], left_[u]};
+    }
+
+    int sibling(int u) const {
+        int p = parent_[u];
+        return left_[p] == u ? right_[p] : left_[p];
+    }
+
+    /*
+      Swaps the subtree w, a child of u, with the subtree
+      z, a child of v.
+    */
+    void swap_subtrees(int u, int w, int v, int z) {
+        (left_[u] == w ? left_[u] : right_[u]) = z;
+        (left_[v] == z ? left_[v] : right_[v]) = w;
+        parent_[z] = u;
+        parent_[w] = v;
+    }
+
+    /*
+      Prunes the subtree p, whose parent q must not be the root, and
+      regrafts it onto the edge above y: q is spliced out from between
+      its parent and the sibling of p, and spliced back in between y
+      and its parent. y must be neither q, the root nor a vertex of
+      the subtree p.
+    */
+    void prune_regraft(int p, int y) {
+        int q = parent_[p];
+        int s = sibling(p);
+        int g = parent_[q];
+        (left_[g] == q ? left_[g] : right_[g]) = s;
+        parent_[s] = g;
+
+        int x = parent_[y];
+        (left_[x] == y ? left_[x] : right_[x]) = q;
+        (left_[q] == s ? left_[q] : right_[q]) = y;
+        parent_[q] = x;
+        parent_[y] = q;
+    }
+
+    /*
+      Reroots the subtree p at the edge above y, a vertex of the
+      subtree other than p: p is spliced out from between its
+      children and spliced back in between y and its parent, with
+      the edges on the path from y to p reversed.
+    */
+    void reroot(int p, int y) {
+        std::vector<int> path = {y};
+        while (path.back() != p) path.push_back(parent_[path.back()]);
+
+        size_t k = path.size() - 1;
+        if (k == 1) return;
+
+        int d = left_[p] == path[k - 1] ? right_[p] : left_[p];
+        for (size_t i = 1; i < k; i++) {
+            int new_child = i + 1 < k ? path[i + 1] : d;
+            (left_[path[i]] == path[i - 1] ? left_[path[i]] : right_[path[i]]) = new_child;
+            parent_[new_child] = path[i];
+        }
+
+        left_[p] = path[0];
+        right_[p] = path[1];
+        parent_[path[0]] = p;
+        parent_[path[1]] = p;
+    }
+
+    /*
+      Returns all edges (u, v) sorted lexicographically,
+      i.e. the order of digraph::edges.
+    */
+    std::vector<std::pair<int, int>> edges() const {
+        std::vector<std::pair<int, int>> edges;
+        for (size_t u = 0; u < size(); u++) {
+            if (is_leaf(u)) continue;
+            for (int v : children(u)) {
+                if (v != none) edges.push_back(std::make_pair(u, v));
+            }
+        }
+        return edges;
+    }
+};
+
+/*
+  Conversions to and from the general digraph representation
+  used for I/O. convert maps vertex data of the source type
+  to vertex data of the target type.
+*/
+template <class T, class S, class F>
+binary_tree<T> to_binary_tree(const digraph<S>& g, F convert) {
+    binary_tree<T> t;
+    for (int u : g.nodes()) {
+        t.add_vertex(convert(g[u].data));
+    }
+
+    for (auto [u, v] : g.edges()) {
+        t.add_edge(u, v);
+    }
+
+    return t;
+}
+
+template <class T, class S, class F>
+digraph<T> to_digraph(const binary_tree<S>& t, F convert) {
+    digraph<T> g;
+    for (size_t u = 0; u < t.size(); u++) {
+        g.add_vertex(convert(t[u]));
+    }
+
+    for (auto [u, v] : t.edges()) {
+        g.add_edge(u, v);
+    }
+
+    return g;
+}
+
+#endif
@@ -1,14 +1,26 @@
 #ifndef _COPY_NUMBER_H
 #define _COPY_NUMBER_H
 
+#include "binary_tree.hpp"
 #include "digraph.hpp"
+#include "interval_arena.hpp"
+#include "thread_pool.hpp"
 
+#include <array>
+#include <cstdint>
+#include <deque>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <random>
 #include <vector>
 #include <string>
 #include <optional>
 #include <stack>
 #include <tuple>
+#include <unordered_map>
+#include <unordered_set>
 
 namespace copynumber {
     struct genomic_bin {
@@ -44,22 +56,32 @@ namespace copynumber {
         friend std::ostream& operator<<(std::ostream& os, const genomic_bin& bin);
     };
 
+    /*
+      Immutable bin table shared by every profile defined over it, so
+      that per cell and per vertex profiles only store their values.
+     */
+    typedef std::shared_ptr<const std::vector<genomic_bin>> shared_bin_table;
+
+    inline shared_bin_table make_bin_table(std::vector<genomic_bin> bins) {
+        return std::make_shared<const std::vector<genomic_bin>>(std::move(bins));
+    }
+
     struct copynumber_profile {
         std::vector<int> profile;
-        std::vector<genomic_bin> bins;
+        shared_bin_table bins;
 
         copynumber_profile() {};
-        copynumber_profile(std::vector<int> profile, std::vector<genomic_bin> bins) :
-            profile(profile), bins(bins) {};
+        copynumber_profile(std::vector<int> profile, shared_bin_table bins) :
+            profile(std::move(profile)), bins(std::move(bins)) {};
     };
 
     struct breakpoint_profile {
         std::vector<int> profile;
-        std::vector<genomic_bin> bins;
+        shared_bin_table bins;
 
         breakpoint_profile() {};
-        breakpoint_profile(std::vector<int> profile, std::vector<genomic_bin> bins) :
-            profile(profile), bins(bins) {};
+        breakpoint_profile(std::vector<int> profile, shared_bin_table bins) :
+            profile(std::move(profile)), bins(std::move(bins)) {};
 
         breakpoint_profile operator+(const breakpoint_profile& other) const {
             breakpoint_profile result;
@@ -90,18 +112,200 @@ namespace copynumber {
 
     /*
       Rectilinear invariant: If visited == true for some vertex u,
-      then for all i, the interval [start_i, end_i] is the set of
-      values minimizing the rectilinear score of the sub-tree rooted
-      at u and score is the minimizing rectlinear score for that
-      sub-tree.
+      then for all i, the interval [start_i, end_i] stored in row u
+      of the interval arena is the set of values minimizing the
+      rectilinear score of the sub-tree rooted at u and score is the
+      minimizing rectlinear score for that sub-tree.
+
+      Outside invariant: For every vertex u other than the root,
+      row u of the outside arena holds the optimal intervals of the
+      tree obtained by removing the sub-tree rooted at u, rooted at
+      the parent of u, and outside_score is its rectilinear score.
+
+      clade is the XOR of the keys of the leaves below u, see
+      hash_topology.
      */
     struct rectilinear_vertex_data {
         std::string name;
-        std::optional<std::vector<int>> start;
-        std::optional<std::vector<int>> end;
 
         int score = 0;
+        int outside_score = 0;
         bool visited = false;
+        uint64_t clade = 0;
+    };
+
+    /*
+      Copy number profiles of a set of cells over a shared set of
+      bins, stored as a dense row major cells x bins matrix. Cells
+      and bins are numbered in order of first appearance.
+     */
+    struct copynumber_matrix {
+        std::vector<std::string> cells;
+        std::vector<genomic_bin> bins;
+        std::vector<int> data;
+
+        int* row(size_t cell) {
+            return data.data() + cell * bins.size();
+        }
+
+        const int* row(size_t cell) const {
+            return data.data() + cell * bins.size();
+        }
+    };
+
+    /*
+      Breakpoint profiles of a set of cells over a shared table of
+      *chromosome and allele sorted* bins, stored as a dense row major
+      matrix where row i holds the profile of cell names()[i]. Rows
+      are padded with zeros to a multiple of a cache line, which
+      leaves every distance between rows unchanged.
+     */
+    class breakpoint_matrix {
+    private:
+        static constexpr size_t ints_per_line = 16;
+
+        std::vector<std::string> names_;
+        shared_bin_table bin_table_ = make_bin_table({});
+        size_t stride_ = 0;
+        std::vector<int> data_;
+
+    public:
+        breakpoint_matrix() {};
+        breakpoint_matrix(std::vector<std::string> names, shared_bin_table bin_table) :
+            names_(std::move(names)), bin_table_(std::move(bin_table)),
+            stride_((bin_table_->size() + ints_per_line - 1) / ints_per_line * ints_per_line),
+            data_(names_.size() * stride_, 0) {};
+
+        size_t rows() const {
+            return names_.size();
+        }
+
+        size_t bins() const {
+            return bin_table_->size();
+        }
+
+        size_t stride() const {
+            return stride_;
+        }
+
+        const std::vector<std::string>& names() const {
+            return names_;
+        }
+
+        const shared_bin_table& bin_table() const {
+            return bin_table_;
+        }
+
+        int* row(size_t i) {
+            return data_.data() + i * stride_;
+        }
+
+        const int* row(size_t i) const {
+            return data_.data() + i * stride_;
+        }
+
+        // all rows() * stride() ints, including the padding
+        int* data() {
+            return data_.data();
+        }
+
+        const int* data() const {
+            return data_.data();
+        }
+    };
+
+    /*
+      Builds the breakpoint matrix of a set of profiles over the same
+      bins, with rows in the (sorted) order of the cell names. Throws
+      if the profiles are not defined over the same number of bins.
+     */
+    breakpoint_matrix make_breakpoint_matrix(const std::map<std::string, breakpoint_profile>& profiles);
+
+    /*
+      Bins whose breakpoint columns are identical across all cells
+      are scored identically, so they are collapsed into unique site
+      patterns. Pattern p occurs weights[p] times and bin i is an
+      occurrence of pattern pattern_of_bin[i].
+     */
+    struct site_patterns {
+        std::vector<int> weights;
+        std::vector<size_t> pattern_of_bin;
+        std::vector<size_t> representative; // first bin of each pattern
+
+        size_t num_patterns() const { return weights.size(); }
+
+        // restricts a full length profile to one value per pattern
+        std::vector<int> compress(const std::vector<int>& profile) const;
+
+        // expands a per pattern profile back to one value per bin
+        std::vector<int> expand(const std::vector<int>& pattern_profile) const;
+    };
+
+    /*
+      Finds the site patterns of the breakpoint profiles of a set of cells.
+     */
+    site_patterns find_site_patterns(const breakpoint_matrix& profiles);
+
+    /*
+      A binary tree together with the arenas holding the (inside and
+      outside) intervals of its vertices, where vertex u owns row u
+      of each arena. The arenas hold one column per site pattern.
+
+      topology is a hash of the clades of the tree, see hash_topology.
+     */
+    struct rectilinear_tree {
+        binary_tree<rectilinear_vertex_data> tree;
+        interval_arena intervals;
+        interval_arena outside;
+        std::shared_ptr<const site_patterns> patterns;
+        uint64_t topology = 0;
+    };
+
+    /*
+      Allocates an inside arena for tree over the given number of
+      bins, storing the rows of its leaves, which only ever hold
+      points, as point rows.
+     */
+    interval_arena inside_arena(const binary_tree<rectilinear_vertex_data>& tree, size_t bins,
+                                arena_layout layout = arena_layout::node_major,
+                                interval_type type = interval_type::i32);
+
+    /*
+      Site patterns of the leaves of a tree split into blocks of a
+      fixed number of patterns, so that trees can be evaluated one
+      block at a time with only a single block of intervals held in
+      their arenas. The last block is padded with patterns of weight
+      zero, which contribute nothing to any score.
+
+      Every score decomposes over the patterns, so the score of a
+      tree is the sum of its scores over all blocks.
+     */
+    class pattern_blocks {
+    private:
+        std::shared_ptr<const site_patterns> patterns_;
+        size_t width = 0;
+        size_t nblocks = 0;
+        std::vector<std::shared_ptr<const site_patterns>> block_patterns; // weights of each block
+        std::vector<int> leaf_row; // of each vertex, -1 for internal vertices
+        std::vector<int> values;   // nblocks * width values per leaf
+
+    public:
+        pattern_blocks(std::shared_ptr<const site_patterns> patterns, size_t num_vertices, size_t block_width);
+
+        const std::shared_ptr<const site_patterns>& patterns() const { return patterns_; }
+        size_t block_width() const { return width; }
+        size_t num_blocks() const { return nblocks; }
+        size_t block_begin(size_t block) const { return block * width; }
+
+        // sets the (compressed) site pattern values of leaf vertex u
+        void set_point(size_t u, const int* values);
+
+        /*
+          Points t at the weights of a block, (re)sizes its arenas to
+          a block and fills in the intervals of its leaves. Unvisits
+          every vertex of t.
+         */
+        void load(rectilinear_tree& t, size_t block) const;
     };
 
     struct breakpoint_profile_vertex_data {
@@ -124,16 +328,53 @@ namespace copynumber {
     breakpoint_profile convert_to_breakpoint_profile(const copynumber_profile &p, int diploid_cn);
     copynumber_profile convert_to_copynumber_profile(const breakpoint_profile &p, int diploid_cn);
 
+    /*
+      Chromosome and allele sorted order of a bin table. It is computed
+      once per dataset and applied to every profile over the table,
+      so the conversions below reduce to a gather and a difference
+      (or prefix sum) over each chromosome and allele segment.
+     */
+    struct bin_order {
+        shared_bin_table sorted_bins;
+        std::vector<size_t> permutation;    // sorted bin i is bin permutation[i], empty if already sorted
+        std::vector<size_t> segment_starts; // of each chromosome and allele, followed by the number of bins
+    };
+
+    bin_order sort_bins(const shared_bin_table& bins);
+
+    // requires p to be defined over the bins order was computed from
+    breakpoint_profile convert_to_breakpoint_profile(const copynumber_profile &p, const bin_order& order, int diploid_cn);
+    copynumber_profile convert_to_copynumber_profile(const breakpoint_profile &p, const bin_order& order, int diploid_cn);
+
+    /*
+      Converts all copy number profiles of m into a breakpoint matrix
+      with rows in the (sorted) order of the cell names, distributing
+      the cells over the pool if one is given.
+     */
+    breakpoint_matrix convert_to_breakpoint_matrix(const copynumber_matrix& m, int diploid_cn, thread_pool* pool = nullptr);
+
     /*
       Overlaps two intervals [s1, e1], [s2, e2], returning the empty set 
       if they do not overlap.
      */
     std::optional<std::pair<int, int>> overlap(int s1, int e1, int s2, int e2);
-    std::tuple<std::vector<int>, std::vector<int>, int> sankoff(const rectilinear_vertex_data& u, const rectilinear_vertex_data& v);
+
+    /*
+      Merges the optimal intervals of two sibling vertices u and v,
+      writing the intervals of their parent into row parent and
+      returning the rectilinear distance between u and v, where each
+      site pattern is weighted by its multiplicity. Runs on the
+      kernel selected by kernels::dispatch().
+     */
+    int sankoff(rectilinear_tree& t, int u, int v, int parent);
 
     /*
       Solves the small rectilinear problem for the sub-trees
       rooted at every vertex. Avoids excess recomputation.
+
+      As the score is a sum over bins, if a pool is given the bins
+      are split into one shard per thread (when wide enough) and
+      each thread runs the pass over its own shard.
       
       Requires:
         - t satisfies the *rectilinear invariant*.
@@ -142,48 +383,233 @@ namespace copynumber {
         - sets visited == true for all vertices in t.
         - t satisfies the *rectilinear invariant*.
     */
-    void small_rectilinear(digraph<rectilinear_vertex_data>& t, int root);
+    void small_rectilinear(rectilinear_tree& t, int root, thread_pool* pool = nullptr);
+
+    /*
+      Computes the outside intervals and scores of every vertex
+      by a top-down pass over the tree, sharding the bins over the
+      pool as small_rectilinear does.
+
+      Requires:
+        - t satisfies the *rectilinear invariant*.
+        - has visited == true for all vertices in t
+
+      Output guarantees:
+        - t satisfies the *outside invariant*.
+    */
+    void outside_rectilinear(rectilinear_tree& t, int root, thread_pool* pool = nullptr);
 
     /*
-      Computes the (delta profile) ancestral labeling for a tree.
+      Returns the rectilinear score of t after performing the NNI
+      on edges (u, w) and (v, z), where v is a child of u. Only the
+      four interval sets around the edge (u, v) are merged, so this
+      takes O(bins) time and does not modify t.
+
+      Bins are scored in chunks, stopping early once the partial score
+      reaches ceiling, in which case some score >= ceiling is returned.
+
+      Requires:
+        - t satisfies the *rectilinear invariant*.
+        - t satisfies the *outside invariant*.
+    */
+    int nni_score(const rectilinear_tree& t, int root, int u, int w, int v, int z,
+                  int ceiling = std::numeric_limits<int>::max());
+
+    /*
+      Computes the (delta profile) ancestral labeling for a tree,
+      expanding site patterns back to the full set of bins.
 
       Requires:
         - t satisfies the *rectilinear invariant*. 
         - has visited == true for all vertices in t
         - bins is a *chromosome and allele sorted* set of bins for a breakpoint profile
      */
-    digraph<breakpoint_profile_vertex_data> ancestral_labeling(digraph<rectilinear_vertex_data>& t,
+    digraph<breakpoint_profile_vertex_data> ancestral_labeling(rectilinear_tree& t,
+                                                               int root,
+                                                               const shared_bin_table& bins);
+
+    /*
+      Block by block versions of small_rectilinear and ancestral_labeling,
+      which require nothing of t and leave the total scores in t and its
+      arenas holding the last block.
+     */
+    void small_rectilinear(rectilinear_tree& t, int root, const pattern_blocks& blocks, thread_pool* pool = nullptr);
+    digraph<breakpoint_profile_vertex_data> ancestral_labeling(rectilinear_tree& t,
                                                                int root,
-                                                               std::vector<genomic_bin> bins);
+                                                               const shared_bin_table& bins,
+                                                               const pattern_blocks& blocks,
+                                                               thread_pool* pool = nullptr);
         
 
+    /*
+      Restores the rectilinear invariant after the NNI on edges (u, w)
+      and (v, z) was performed on t. Only v and u are merged in full;
+      above u, just the bins whose intervals changed are re-merged,
+      and propagation stops once no interval changes, leaving only a
+      score delta to add to the remaining ancestors.
+
+      Requires:
+        - t satisfied the *rectilinear invariant* before the NNI.
+     */
+    void rescore_nni(rectilinear_tree& t, int root, int u, int v);
+
+    /*
+      Hashes the topology of t, rooted at vertex 0, from scratch. Every
+      leaf is keyed by a hash of its vertex id, the clade of a vertex
+      is the XOR of the keys of the leaves below it, and the topology
+      hash is the XOR of the (mixed) clades of all vertices, so equal
+      hashes identify equal sets of clades with high probability.
+
+      An NNI changes exactly one clade, so nni and undo_nni update the
+      hash in O(1), while spr and tbr rehash t.
+     */
+    void hash_topology(rectilinear_tree& t);
+
+    /*
+      Bounded set of topology hashes that can be shared by concurrent
+      searches. Hashes are spread over shards, each with its own lock
+      and evicting its oldest entry once full.
+     */
+    class topology_cache {
+    private:
+        static constexpr size_t num_shards = 16;
+
+        struct shard {
+            std::mutex mutex;
+            std::unordered_set<uint64_t> topologies;
+            std::deque<uint64_t> insertion_order;
+        };
+
+        size_t shard_capacity;
+        std::array<shard, num_shards> shards;
+
+    public:
+        explicit topology_cache(size_t capacity);
+
+        bool contains(uint64_t topology);
+        void insert(uint64_t topology);
+    };
+
     /*
       Performs (or undos) a NNI operation on edges (u, w) and (v, z) by
-      swapping the edges.
+      swapping the edges in O(1).
       
       Does not necessarily maintain rectlinear invariant, but it can be
       re-maintained by calling unvisit(t, u) and unvisit(t, w).
     */
-    void nni(digraph<rectilinear_vertex_data>& t, int u, int w, int v, int z);
-    void undo_nni(digraph<rectilinear_vertex_data>& t, int u, int w, int v, int z);
+    void nni(rectilinear_tree& t, int u, int w, int v, int z);
+    void undo_nni(rectilinear_tree& t, int u, int w, int v, int z);
+
+    /*
+      Performs the SPR operation pruning the subtree p and regrafting
+      it onto the edge above y, see binary_tree::prune_regraft. Like
+      nni, it does not maintain the rectilinear invariant.
+    */
+    void spr(rectilinear_tree& t, int p, int y);
+
+    /*
+      Returns the rectilinear scores of the trees obtained by pruning
+      the subtree p and regrafting it onto every edge within radius
+      edges of its current position, as (y, score) pairs in a fixed
+      order, where y is the vertex below the regraft edge. Each score
+      takes a single merge of the cached intervals on either side of
+      the regraft edge with those of p, plus the merge that extends
+      the walk to the edge. Neither p nor its parent may be the root.
+
+      scratch is resized as needed to hold the intervals computed
+      along the walk.
+
+      Requires:
+        - t satisfies the *rectilinear invariant*.
+        - t satisfies the *outside invariant*.
+    */
+    std::vector<std::pair<int, int>> spr_scores(const rectilinear_tree& t, int p, int radius,
+                                                interval_arena& scratch);
+
+    /*
+      Performs the TBR operation bisecting t at the edge above p,
+      rerooting the subtree p at the edge above r, a vertex of the
+      subtree (or p itself to keep its root), and reconnecting it
+      onto the edge above y, see binary_tree::reroot and
+      binary_tree::prune_regraft.
+    */
+    void tbr(rectilinear_tree& t, int p, int r, int y);
 
     /*
       Unvisits all vertices on path from root to u. Trivially
       guarantees the *rectilinear invariant*.
      */
-    void unvisit(digraph<rectilinear_vertex_data> &t, int root, int u);
+    void unvisit(rectilinear_tree &t, int root, int u);
 
     /*
       Unvisits all vertices in sub-tree rooted at root. Trivially
       guarantees the *rectilinear invariant*.
      */
-    void unvisit(digraph<rectilinear_vertex_data> &t, int root);
+    void unvisit(rectilinear_tree &t, int root);
 
     /*
       Assumes the root is the 0 vertex.
     */
-    digraph<rectilinear_vertex_data> stochastic_nni(const digraph<rectilinear_vertex_data>& t, std::ranlux48_base& gen, float aggression);
+    rectilinear_tree stochastic_nni(const rectilinear_tree& t, std::ranlux48_base& gen, float aggression);
+
+
+    /*
+      Neighborhoods explored by hill climbing: NNIs only, or subtree
+      prune and regraft moves within a radius.
+     */
+    enum class move_set {
+        nni,
+        spr
+    };
+
+    inline move_set parse_move_set(const std::string& name) {
+        if (name == "nni") return move_set::nni;
+        if (name == "spr") return move_set::spr;
+        throw std::invalid_argument("unknown move set: " + name);
+    }
+
+    /*
+      Options controlling the hill climbing search.
+        - greedy: if true, selects the first improvement at every iteration. otherwise, 
+          explores entire NNI neighborhood for improvement at every iteration.
+        - pool: if set, NNI neighborhoods are scored in parallel on the pool. The
+          selected moves, and hence the search trajectory, do not depend on the 
+          number of threads.
+        - shard_bins: if true, every evaluation of the tree is also split into
+          shards of bins run on the pool. Pays off for very wide profiles over
+          few cells, where NNI neighborhoods are too small to fill the pool.
+        - blocks: if set, trees are evaluated one block of site patterns at a
+          time. Every iteration then scores the whole neighborhood block by
+          block, which selects the same moves as the in-memory search.
+        - moves: the neighborhood explored at every iteration.
+        - spr_radius: the maximum number of edges between the pruned and the
+          regrafted position of an SPR move.
+        - move_queue: if true, NNI gains are kept in a priority queue and only
+          the moves around each applied NNI are re-evaluated, instead of
+          rescanning the neighborhood after every move. Applies to the in
+          memory NNI search, where it replaces greedy.
+        - batch: if true, every iteration applies a maximal set of improving
+          NNIs on disjoint vertices at once, falling back to the best single
+          move if the batch scores no better. Applies to the in memory NNI
+          search, where it replaces greedy.
+        - cache: if set, every climb records the topology it ends in, and
+          stops as soon as it reaches a topology some climb ended in before.
+    */
+    struct search_options {
+        bool greedy = false;
+        move_set moves = move_set::nni;
+        int spr_radius = 3;
+        bool move_queue = false;
+        bool batch = false;
+        topology_cache* cache = nullptr;
+        thread_pool* pool = nullptr;
+        bool shard_bins = false;
+        const pattern_blocks* blocks = nullptr;
 
+        thread_pool* bin_pool() const {
+            return shard_bins ? pool : nullptr;
+        }
+    };
 
     /*
     * Performs hill climbing on the rectilinear score of the input tree until no
@@ -191,11 +617,35 @@ namespace copynumber {
     *
     * Parameters
     *    - t: input tree does not need to satisfy rectilinear invariant.
-    *    - greedy: if true, selects the first improvement at every iteration. otherwise, 
-    *      explores entire NNI neighborhood for improvement at every iteration.
     *    - gen: random generator to shuffle edges for random exploration.
+    *    - options: search strategy, see search_options.
     */
-    digraph<rectilinear_vertex_data> hill_climb(digraph<rectilinear_vertex_data> t, std::ranlux48_base& gen, bool greedy);
+    rectilinear_tree hill_climb(rectilinear_tree t, std::ranlux48_base& gen, const search_options& options);
+
+    /*
+      Polishes t with TBR moves until no move within radius improves
+      it or the time budget of seconds runs out. Every iteration
+      bisects t at each edge not incident to the root, reroots the
+      pruned subtree at its edges up to radius away from its root
+      edge and reconnects it to the edges up to radius away from
+      where it was pruned, applying the best move.
+
+      Reconnections are scored by merging the cached intervals of the
+      two components, with bisections scored in parallel on the pool.
+      In memory, bisections are no longer scored once the budget has
+      run out; block by block, the budget is only checked between
+      iterations.
+
+      Requires:
+        - t satisfies the *rectilinear invariant*.
+    */
+    rectilinear_tree tbr_polish(rectilinear_tree t, const search_options& options, int radius, double seconds);
+
+    /*
+      Solves the small rectilinear problem for t rooted at vertex 0,
+      either in memory or block by block as set by options.
+     */
+    void score_tree(rectilinear_tree& t, const search_options& options);
 
     /*
       Computes the breakpoint magnitude of a *chromosome and allele sorted*
@@ -0,0 +1,56 @@
+#ifndef _DISTANCE_MATRIX_H
+#define _DISTANCE_MATRIX_H
+
+#include "copy_number.hpp"
+#include "thread_pool.hpp"
+
+#include <utility>
+#include <vector>
+
+namespace copynumber {
+    /*
+      Symmetric n x n distance matrix with a zero diagonal, storing
+      only the upper triangle in condensed row major form.
+     */
+    class distance_matrix {
+    private:
+        size_t n = 0;
+        std::vector<int> data;
+
+        size_t index(size_t i, size_t j) const {
+            if (i > j) std::swap(i, j);
+            return i * n - i * (i + 1) / 2 + j;
+        }
+
+    public:
+        distance_matrix() {};
+        explicit distance_matrix(size_t n) : n(n), data(n * (n + 1) / 2, 0) {};
+
+        size_t size() const {
+            return n;
+        }
+
+        int operator()(size_t i, size_t j) const {
+            return data[index(i, j)];
+        }
+
+        int& operator()(size_t i, size_t j) {
+            return data[index(i, j)];
+        }
+    };
+
+    /*
+      Computes the L1 (i.e. breakpoint) distance between every pair of
+      rows of m. The upper triangle is split into tiles of row pairs
+      whose bins are swept in chunks small enough for both tiles to
+      stay in cache, and tiles are distributed over the pool if one
+      is given.
+
+      The rows are first copied into 8 or 16 bit storage when all
+      values of m fit, which packs four or two times as many bins
+      into every register and cache line.
+     */
+    distance_matrix l1_distance_matrix(const breakpoint_matrix& m, thread_pool* pool = nullptr);
+};
+
+#endif
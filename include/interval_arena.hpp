@@ -0,0 +1,301 @@
+#ifndef _INTERVAL_ARENA_H
+#define _INTERVAL_ARENA_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace copynumber {
+    enum class arena_layout {
+        node_major,
+        bin_major
+    };
+
+    /*
+      Storage type of the interval endpoints held by an arena. Merging
+      never leaves the range of the values merged, so all intervals of
+      a tree fit the type its leaves fit, but the interval kernels
+      also compute the gaps between endpoints in the storage type,
+      which therefore has to fit the width of the range as well.
+     */
+    enum class interval_type {
+        i8,
+        i16,
+        i32
+    };
+
+    inline size_t interval_type_size(interval_type type) {
+        switch (type) {
+            case interval_type::i8: return sizeof(signed char);
+            case interval_type::i16: return sizeof(short);
+            default: return sizeof(int);
+        }
+    }
+
+    // the narrowest interval type holding values in [lo, hi]
+    inline interval_type narrowest_interval_type(int lo, int hi) {
+        if (lo >= -64 && hi <= 63) return interval_type::i8;
+        if (lo >= -16384 && hi <= 16383) return interval_type::i16;
+        return interval_type::i32;
+    }
+
+    /*
+      Calls f with a value of the C++ type storing endpoints of the
+      given type, i.e. f(signed char()), f(short()) or f(int()), so
+      that f can instantiate code over that type.
+     */
+    template <typename F>
+    decltype(auto) visit_interval_type(interval_type type, F&& f) {
+        switch (type) {
+            case interval_type::i8: return f((signed char) 0);
+            case interval_type::i16: return f((short) 0);
+            default: return f((int) 0);
+        }
+    }
+
+    /*
+      Contiguous, cache line aligned storage for the [start, end]
+      intervals of every vertex of a tree, where row u holds the
+      intervals of vertex u. Endpoints are stored as 8, 16 or 32 bit
+      integers depending on the interval_type of the arena, and
+      start<T>/end<T> must be called with the matching C++ type.
+
+      The bins are split into blocks and a (row, block) pair addresses
+      block_size(block) contiguous endpoints for both start and end,
+      which is the unit the interval kernels operate on.
+
+        node_major: a single block spanning all bins, so each row
+                    is stored contiguously.
+        bin_major:  blocks of block_width bins, where each block
+                    stores the rows of all vertices contiguously.
+
+      Rows may be declared point rows, which only ever hold degenerate
+      intervals [x, x] (e.g. the leaves of a tree). A point row stores
+      its start once and its end aliases the start, so writing to the
+      end of a point row overwrites its start.
+
+      Copying an arena is a single allocation and memcpy.
+     */
+    class interval_arena {
+    private:
+        static constexpr size_t alignment = 64;
+
+        struct aligned_deleter {
+            void operator()(unsigned char* p) const {
+                ::operator delete(p, std::align_val_t(alignment));
+            }
+        };
+
+        size_t nrows = 0;
+        size_t nbins = 0;
+        size_t width = 0;  // bins per block
+        size_t span = 0;   // endpoints reserved for one of start/end of a (row, block)
+        size_t nblocks = 0;
+        arena_layout arena_layout_ = arena_layout::node_major;
+        interval_type type_ = interval_type::i32;
+        size_t elem_size = sizeof(int);
+        std::vector<size_t> row_begin = {0};  // offset of each row within a block, in spans
+        std::unique_ptr<unsigned char[], aligned_deleter> data;
+
+        static unsigned char* allocate(size_t bytes) {
+            if (bytes == 0) return nullptr;
+            return static_cast<unsigned char*>(::operator new(bytes, std::align_val_t(alignment)));
+        }
+
+        size_t offset(size_t row, size_t block) const {
+            return (block * row_begin[nrows] + row_begin[row]) * span;
+        }
+
+        unsigned char* row_data(size_t row, size_t block) { return data.get() + offset(row, block) * elem_size; }
+        const unsigned char* row_data(size_t row, size_t block) const { return data.get() + offset(row, block) * elem_size; }
+
+        template <typename T>
+        T& at(size_t row, size_t bin, bool end_point) {
+            return (end_point ? end<T>(row, bin / width) : start<T>(row, bin / width))[bin % width];
+        }
+
+        template <typename T>
+        int at(size_t row, size_t bin, bool end_point) const {
+            return (end_point ? end<T>(row, bin / width) : start<T>(row, bin / width))[bin % width];
+        }
+
+    public:
+        static constexpr size_t default_block_width = 1024;
+
+        interval_arena() {};
+
+        interval_arena(size_t rows, size_t bins,
+                       arena_layout layout = arena_layout::node_major,
+                       size_t block_width = default_block_width,
+                       interval_type type = interval_type::i32) :
+            interval_arena(std::vector<bool>(rows, false), bins, layout, block_width, type) {};
+
+        /*
+          Allocates an arena with one row per entry of point_rows,
+          where row u is a point row iff point_rows[u].
+         */
+        interval_arena(const std::vector<bool>& point_rows, size_t bins,
+                       arena_layout layout = arena_layout::node_major,
+                       size_t block_width = default_block_width,
+                       interval_type type = interval_type::i32) :
+            nrows(point_rows.size()), nbins(bins), arena_layout_(layout),
+            type_(type), elem_size(interval_type_size(type)) {
+            if (layout == arena_layout::bin_major && block_width == 0) {
+                throw std::invalid_argument("block width must be positive");
+            }
+
+            size_t elems_per_line = alignment / elem_size;
+            width = layout == arena_layout::node_major ? bins : std::min(block_width, bins);
+            span = (width + elems_per_line - 1) / elems_per_line * elems_per_line;
+            nblocks = width == 0 ? 0 : (bins + width - 1) / width;
+            for (bool point : point_rows) {
+                row_begin.push_back(row_begin.back() + (point ? 1 : 2));
+            }
+
+            data.reset(allocate(bytes()));
+            if (data) std::memset(data.get(), 0, bytes());
+        }
+
+        interval_arena(const interval_arena& other) :
+            nrows(other.nrows), nbins(other.nbins), width(other.width),
+            span(other.span), nblocks(other.nblocks), arena_layout_(other.arena_layout_),
+            type_(other.type_), elem_size(other.elem_size),
+            row_begin(other.row_begin), data(allocate(other.bytes())) {
+            if (data) std::memcpy(data.get(), other.data.get(), bytes());
+        }
+
+        interval_arena(interval_arena&& other) = default;
+
+        interval_arena& operator=(const interval_arena& other) {
+            if (this == &other) return *this;
+
+            if (bytes() != other.bytes()) {
+                data.reset(allocate(other.bytes()));
+            }
+
+            nrows = other.nrows;
+            nbins = other.nbins;
+            width = other.width;
+            span = other.span;
+            nblocks = other.nblocks;
+            arena_layout_ = other.arena_layout_;
+            type_ = other.type_;
+            elem_size = other.elem_size;
+            row_begin = other.row_begin;
+            if (data) std::memcpy(data.get(), other.data.get(), bytes());
+            return *this;
+        }
+
+        interval_arena& operator=(interval_arena&& other) = default;
+
+        size_t rows() const { return nrows; }
+        size_t bins() const { return nbins; }
+        arena_layout layout() const { return arena_layout_; }
+        interval_type type() const { return type_; }
+
+        // total number of endpoints held by the arena
+        size_t size() const { return nblocks * row_begin[nrows] * span; }
+
+        // total number of bytes held by the arena
+        size_t bytes() const { return size() * elem_size; }
+
+        bool is_point(size_t row) const { return row_begin[row + 1] - row_begin[row] == 1; }
+
+        size_t num_blocks() const { return nblocks; }
+        size_t block_begin(size_t block) const { return block * width; }
+        size_t block_size(size_t block) const {
+            return std::min(width, nbins - block_begin(block));
+        }
+
+        template <typename T>
+        T* start(size_t row, size_t block = 0) { return reinterpret_cast<T*>(row_data(row, block)); }
+        template <typename T>
+        T* end(size_t row, size_t block = 0) { return start<T>(row, block) + (is_point(row) ? 0 : span); }
+        template <typename T>
+        const T* start(size_t row, size_t block = 0) const { return reinterpret_cast<const T*>(row_data(row, block)); }
+        template <typename T>
+        const T* end(size_t row, size_t block = 0) const { return start<T>(row, block) + (is_point(row) ? 0 : span); }
+
+        // the start (or end) of row at a single bin, as T, which must be the type of the arena
+        template <typename T>
+        T& start_at(size_t row, size_t bin) { return at<T>(row, bin, false); }
+        template <typename T>
+        T& end_at(size_t row, size_t bin) { return at<T>(row, bin, true); }
+
+        // the start (or end) of row at a single bin, of any type
+        int start_at(size_t row, size_t bin) const {
+            return visit_interval_type(type_, [&](auto t) { return at<decltype(t)>(row, bin, false); });
+        }
+
+        int end_at(size_t row, size_t bin) const {
+            return visit_interval_type(type_, [&](auto t) { return at<decltype(t)>(row, bin, true); });
+        }
+
+        /*
+          Sets row to the degenerate intervals [values_i, values_i],
+          as is the case for the leaves of a tree. Every value must
+          fit the type of the arena.
+         */
+        void set_point(size_t row, const int* values) {
+            visit_interval_type(type_, [&](auto t) {
+                typedef decltype(t) T;
+                for (size_t b = 0; b < nblocks; b++) {
+                    const int* block_values = values + block_begin(b);
+                    std::copy(block_values, block_values + block_size(b), start<T>(row, b));
+                    if (!is_point(row)) std::copy(block_values, block_values + block_size(b), end<T>(row, b));
+                }
+            });
+        }
+
+        /*
+          Copies row other_row of an arena of the same shape and type
+          into row, which may only be a point row if other_row is one
+          too.
+         */
+        void copy_row(size_t row, const interval_arena& other, size_t other_row) {
+            for (size_t b = 0; b < nblocks; b++) {
+                std::memcpy(row_data(row, b), other.row_data(other_row, b), span * elem_size);
+                if (!is_point(row)) {
+                    std::memcpy(row_data(row, b) + span * elem_size,
+                                other.row_data(other_row, b) + (other.is_point(other_row) ? 0 : span * elem_size),
+                                span * elem_size);
+                }
+            }
+        }
+
+        /*
+          Copies the start (or end) of a row into a contiguous
+          buffer of bins() ints.
+         */
+        void copy_start(size_t row, int* out) const {
+            visit_interval_type(type_, [&](auto t) {
+                typedef decltype(t) T;
+                for (size_t b = 0; b < nblocks; b++) {
+                    std::copy(start<T>(row, b), start<T>(row, b) + block_size(b), out + block_begin(b));
+                }
+            });
+        }
+
+        void copy_end(size_t row, int* out) const {
+            visit_interval_type(type_, [&](auto t) {
+                typedef decltype(t) T;
+                for (size_t b = 0; b < nblocks; b++) {
+                    std::copy(end<T>(row, b), end<T>(row, b) + block_size(b), out + block_begin(b));
+                }
+            });
+        }
+    };
+
+    inline arena_layout parse_arena_layout(const std::string& name) {
+        if (name == "node-major") return arena_layout::node_major;
+        if (name == "bin-major") return arena_layout::bin_major;
+        throw std::invalid_argument("unknown interval layout: " + name);
+    }
+};
+
+#endif
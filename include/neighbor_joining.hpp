@@ -0,0 +1,32 @@
+#ifndef _NEIGHBOR_JOINING_H
+#define _NEIGHBOR_JOINING_H
+
+#include <cstdio> // clearcut.h uses FILE without including it
+
+#include "clearcut.h"
+#include "digraph.hpp"
+#include "distance_matrix.hpp"
+#include "tree_io.hpp"
+
+#include <string>
+#include <vector>
+
+namespace copynumber {
+    /*
+      Builds a Clearcut distance matrix directly from the pairwise
+      distances between the named cells, as NJ_parse_distance_matrix
+      would from its text representation. The caller owns the result
+      and releases it with NJ_free_dmat.
+     */
+    DMAT* make_dmat(const std::vector<std::string>& names, const distance_matrix& d);
+
+    /*
+      Converts a Clearcut neighbor joining tree into a digraph rooted
+      at vertex 0. Vertices are numbered and named exactly as
+      treeio::read_newick_node numbers and names the Newick output
+      of NJ_output_tree, so both yield the same downstream search.
+     */
+    digraph<treeio::newick_vertex_data> from_nj_tree(const NJ_TREE* tree, const DMAT* dmat);
+};
+
+#endif
@@ -0,0 +1,71 @@
+#ifndef _PROFILE_IO_H
+#define _PROFILE_IO_H
+
+#include "copy_number.hpp"
+#include "thread_pool.hpp"
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace copynumber {
+    /*
+      Read-only memory mapping of an entire file.
+     */
+    class mapped_file {
+    private:
+        const char* data_ = nullptr;
+        size_t size_ = 0;
+
+    public:
+        explicit mapped_file(const std::string& filename);
+        ~mapped_file();
+
+        mapped_file(const mapped_file&) = delete;
+        mapped_file& operator=(const mapped_file&) = delete;
+
+        std::string_view view() const {
+            return std::string_view(data_, size_);
+        }
+    };
+
+    /*
+      Reads copy number profiles from a CSV file with (at least) the
+      columns node, chrom, start, end and cn_a, in any order. Fields
+      are parsed in place from a memory mapping of the file, with cell
+      names and (chrom, start, end) bins interned to integer ids.
+
+      If a pool is given, the file is split at line boundaries into
+      chunks that are parsed in parallel.
+
+      Gzip compressed files, including multi-member (e.g. bgzip)
+      files, are detected from their magic bytes and inflated on a
+      background thread while the decompressed text is parsed.
+
+      Throws std::runtime_error if the file is malformed or if some
+      cell has none or several copy numbers for a bin.
+     */
+    copynumber_matrix read_copynumber_matrix(const std::string& filename, thread_pool* pool = nullptr);
+
+    /*
+      Binary cache of the breakpoint profiles of a set of cells, as
+      written by `lazac convert`. The file starts with a fixed size
+      header holding a magic number, the format version, the section
+      offsets and a CRC-32 of the rest of the file. It is followed by
+      a string table, the bin table, the cell names and the padded
+      breakpoint matrix, which is stored exactly as it is laid out in
+      memory.
+     */
+    void write_profile_cache(const std::string& filename, const breakpoint_matrix& m);
+
+    // checks the magic number only
+    bool is_profile_cache(const std::string& filename);
+
+    /*
+      Reads a binary profile cache, throwing std::runtime_error if
+      it is truncated, corrupt or of an unsupported version.
+     */
+    breakpoint_matrix read_profile_cache(const std::string& filename);
+};
+
+#endif
@@ -0,0 +1,121 @@
+#ifndef _SANKOFF_KERNELS_H
+#define _SANKOFF_KERNELS_H
+
+#include <cstddef>
+
+namespace copynumber {
+    namespace kernels {
+        /*
+          Interval kernels over endpoints stored as T (int, short or
+          signed char). Intervals are merged in lanes of T, so every
+          endpoint must lie in a range whose width fits T, while costs
+          are weighted and summed in 32 bit lanes.
+         */
+        template <typename T>
+        struct interval_kernels {
+            /*
+              Merges the optimal intervals of two children bin by bin,
+              writing the parent intervals into start/end and returning
+              the rectilinear distance between the children, where the
+              distance in bin i is counted weights[i] times.
+             */
+            int (*merge)(const T* u_start, const T* u_end,
+                         const T* v_start, const T* v_end,
+                         const int* weights,
+                         T* start, T* end, size_t n);
+
+            /*
+              merge where u (merge_point) or both u and v (merge_points)
+              are points, given by a single vector of values.
+             */
+            int (*merge_point)(const T* u,
+                               const T* v_start, const T* v_end,
+                               const int* weights,
+                               T* start, T* end, size_t n);
+            int (*merge_points)(const T* u, const T* v,
+                                const int* weights,
+                                T* start, T* end, size_t n);
+
+            /*
+              Returns the weighted distance accumulated by merging the
+              intervals a with b, the result with c and that result
+              with d, without storing any intervals. triplet_cost
+              stops after c and ignores d.
+             */
+            int (*quartet_cost)(const T* a_start, const T* a_end,
+                                const T* b_start, const T* b_end,
+                                const T* c_start, const T* c_end,
+                                const T* d_start, const T* d_end,
+                                const int* weights, size_t n);
+            int (*triplet_cost)(const T* a_start, const T* a_end,
+                                const T* b_start, const T* b_end,
+                                const T* c_start, const T* c_end,
+                                const T* d_start, const T* d_end,
+                                const int* weights, size_t n);
+
+            /*
+              Labels a child with the value of its optimal interval
+              [start, end] closest to the label of its parent, i.e.
+              clamps the parent label into the interval.
+             */
+            void (*label)(const T* parent, const T* start, const T* end, T* child, size_t n);
+        };
+
+        /*
+          Table of interval kernels compiled for a single instruction
+          set. Every table computes bit-identical results; they only
+          differ in how many bins are processed per instruction.
+         */
+        struct kernel_table {
+            const char* name;
+
+            interval_kernels<int> intervals_i32;
+            interval_kernels<short> intervals_i16;
+            interval_kernels<signed char> intervals_i8;
+
+            // the interval kernels over endpoints of type T
+            template <typename T>
+            const interval_kernels<T>& intervals() const {
+                if constexpr (sizeof(T) == 1) {
+                    return intervals_i8;
+                } else if constexpr (sizeof(T) == 2) {
+                    return intervals_i16;
+                } else {
+                    return intervals_i32;
+                }
+            }
+
+            /*
+              Returns the L1 distance between the integer vectors
+              a and b of length n.
+             */
+            int (*l1_distance)(const int* a, const int* b, size_t n);
+
+            /*
+              The same over 16 and 8 bit vectors, packing two and four
+              times as many bins per register. 16 bit values must lie
+              in [-16384, 16383] so that their differences fit a lane.
+             */
+            int (*l1_distance_i16)(const short* a, const short* b, size_t n);
+            int (*l1_distance_i8)(const signed char* a, const signed char* b, size_t n);
+        };
+
+        const kernel_table& scalar_kernels();
+
+#ifdef LAZAC_HAVE_AVX2
+        const kernel_table& avx2_kernels();
+#endif
+
+#ifdef LAZAC_HAVE_AVX512
+        const kernel_table& avx512_kernels();
+#endif
+
+        /*
+          Returns the widest kernel table supported by the running
+          CPU. The selection is made once, on first use.
+         */
+        const kernel_table& dispatch();
+    };
+};
+
+#endif
@@ -0,0 +1,308 @@
+#ifndef _SANKOFF_KERNELS_IMPL_H
+#define _SANKOFF_KERNELS_IMPL_H
+
+#include "sankoff_kernels.hpp"
+
+#include <cstddef>
+
+/*
+  Kernel bodies shared by every instruction set. Each translation
+  unit defining a kernel_table includes this header and instantiates
+  the kernels with its own Ops type, which provides:
+
+    reg             - the register type
+    elem            - the type of an interval endpoint in memory
+    width           - number of elem lanes in a register
+    load/store      - unaligned memory access
+    min/max/sub     - lane-wise arithmetic on elem lanes
+    zero            - the all zero register
+    acc             - the register type of 32 bit cost accumulators
+    acc_zero        - the all zero accumulator
+    weigh           - adds the lane-wise products of gaps with the
+                      width weights following a pointer into an acc
+    hsum            - horizontal sum of all lanes of an acc
+
+  For 32 bit endpoints acc and reg coincide, and Ops additionally
+  provides add and mul, which l1_distance and the summing of gaps in
+  join_cost rely on.
+
+  The narrow L1 distance kernels instead take an Ops type over 16 or
+  8 bit elements (elem), which provides load, zero, hsum and
+  abs_diff_add, adding the lane-wise |x - y| into wider accumulator
+  lanes so that the sum cannot overflow.
+
+  WARNING: this header is compiled with ISA specific flags (e.g.
+  -mavx2), so it must not pull in any inline code that could be
+  shared with the rest of the program (i.e. no standard library
+  headers beyond <cstddef>).
+*/
+
+namespace copynumber {
+    namespace kernels {
+        namespace {
+            template <typename T>
+            struct scalar_interval_ops {
+                typedef int reg;
+                typedef T elem;
+                typedef int acc;
+                static constexpr size_t width = 1;
+
+                static inline reg load(const T* p) { return *p; }
+                static inline void store(T* p, reg r) { *p = (T) r; }
+                static inline reg min(reg a, reg b) { return a < b ? a : b; }
+                static inline reg max(reg a, reg b) { return a < b ? b : a; }
+                static inline reg add(reg a, reg b) { return a + b; }
+                static inline reg sub(reg a, reg b) { return a - b; }
+                static inline reg mul(reg a, reg b) { return a * b; }
+                static inline reg zero() { return 0; }
+                static inline acc acc_zero() { return 0; }
+                static inline acc weigh(acc a, reg gap, const int* weights) { return a + gap * *weights; }
+                static inline int hsum(acc a) { return a; }
+            };
+
+            typedef scalar_interval_ops<int> scalar_ops;
+
+            /*
+              Branchless form of the Sankoff merge of [s, e] and [os, oe].
+              With lo = max(s, os) and hi = min(e, oe) the intervals
+              overlap iff lo <= hi, in which case the merged interval is
+              [lo, hi] at no cost. Otherwise the merged interval is the
+              gap [hi, lo] at cost lo - hi.
+
+              Replaces [s, e] by the merged interval and returns the cost.
+             */
+            template <class Ops>
+            inline typename Ops::reg join(typename Ops::reg& s, typename Ops::reg& e,
+                                          typename Ops::reg os, typename Ops::reg oe) {
+                typename Ops::reg lo = Ops::max(s, os);
+                typename Ops::reg hi = Ops::min(e, oe);
+                s = Ops::min(lo, hi);
+                e = Ops::max(lo, hi);
+                return Ops::max(Ops::sub(lo, hi), Ops::zero());
+            }
+
+            template <class Ops>
+            int merge(const typename Ops::elem* __restrict u_start, const typename Ops::elem* __restrict u_end,
+                      const typename Ops::elem* __restrict v_start, const typename Ops::elem* __restrict v_end,
+                      const int* __restrict weights,
+                      typename Ops::elem* __restrict start, typename Ops::elem* __restrict end, size_t n) {
+                typename Ops::acc distance = Ops::acc_zero();
+
+                size_t i = 0;
+                for (; i + Ops::width <= n; i += Ops::width) {
+                    typename Ops::reg s = Ops::load(u_start + i);
+                    typename Ops::reg e = Ops::load(u_end + i);
+                    typename Ops::reg gap = join<Ops>(s, e, Ops::load(v_start + i), Ops::load(v_end + i));
+
+                    Ops::store(start + i, s);
+                    Ops::store(end + i, e);
+                    distance = Ops::weigh(distance, gap, weights + i);
+                }
+
+                int total = Ops::hsum(distance);
+                if constexpr (Ops::width > 1) {
+                    typedef scalar_interval_ops<typename Ops::elem> tail_ops;
+                    total += merge<tail_ops>(u_start + i, u_end + i, v_start + i, v_end + i,
+                                             weights + i, start + i, end + i, n - i);
+                }
+
+                return total;
+            }
+
+            /*
+              merge specialized to a point u, i.e. u_start == u_end, which
+              saves the load of u_end.
+             */
+            template <class Ops>
+            int merge_point(const typename Ops::elem* __restrict u,
+                            const typename Ops::elem* __restrict v_start, const typename Ops::elem* __restrict v_end,
+                            const int* __restrict weights,
+                            typename Ops::elem* __restrict start, typename Ops::elem* __restrict end, size_t n) {
+                typename Ops::acc distance = Ops::acc_zero();
+
+                size_t i = 0;
+                for (; i + Ops::width <= n; i += Ops::width) {
+                    typename Ops::reg s = Ops::load(u + i);
+                    typename Ops::reg e = s;
+                    typename Ops::reg gap = join<Ops>(s, e, Ops::load(v_start + i), Ops::load(v_end + i));
+
+                    Ops::store(start + i, s);
+                    Ops::store(end + i, e);
+                    distance = Ops::weigh(distance, gap, weights + i);
+                }
+
+                int total = Ops::hsum(distance);
+                if constexpr (Ops::width > 1) {
+                    typedef scalar_interval_ops<typename Ops::elem> tail_ops;
+                    total += merge_point<tail_ops>(u + i, v_start + i, v_end + i,
+                                                   weights + i, start + i, end + i, n - i);
+                }
+
+                return total;
+            }
+
+            /*
+              merge specialized to two points x and y (e.g. a cherry),
+              where the merged interval is [min(x, y), max(x, y)] at
+              cost |x - y|.
+             */
+            template <class Ops>
+            int merge_points(const typename Ops::elem* __restrict u, const typename Ops::elem* __restrict v,
+                             const int* __restrict weights,
+                             typename Ops::elem* __restrict start, typename Ops::elem* __restrict end, size_t n) {
+                typename Ops::acc distance = Ops::acc_zero();
+
+                size_t i = 0;
+                for (; i + Ops::width <= n; i += Ops::width) {
+                    typename Ops::reg x = Ops::load(u + i);
+                    typename Ops::reg y = Ops::load(v + i);
+                    typename Ops::reg lo = Ops::min(x, y);
+                    typename Ops::reg hi = Ops::max(x, y);
+
+                    Ops::store(start + i, lo);
+                    Ops::store(end + i, hi);
+                    distance = Ops::weigh(distance, Ops::sub(hi, lo), weights + i);
+                }
+
+                int total = Ops::hsum(distance);
+                if constexpr (Ops::width > 1) {
+                    typedef scalar_interval_ops<typename Ops::elem> tail_ops;
+                    total += merge_points<tail_ops>(u + i, v + i, weights + i, start + i, end + i, n - i);
+                }
+
+                return total;
+            }
+
+            /*
+              Weighted cost of merging a with b, the result with c and,
+              if has_d, that result with d. No intervals are stored.
+
+              With 32 bit endpoints the gaps are summed before they are
+              weighted. Narrower lanes only fit a single gap, so each
+              gap is weighted on its own.
+             */
+            template <class Ops, bool has_d>
+            int join_cost(const typename Ops::elem* __restrict a_start, const typename Ops::elem* __restrict a_end,
+                          const typename Ops::elem* __restrict b_start, const typename Ops::elem* __restrict b_end,
+                          const typename Ops::elem* __restrict c_start, const typename Ops::elem* __restrict c_end,
+                          const typename Ops::elem* __restrict d_start, const typename Ops::elem* __restrict d_end,
+                          const int* __restrict weights, size_t n) {
+                typename Ops::acc distance = Ops::acc_zero();
+
+                size_t i = 0;
+                for (; i + Ops::width <= n; i += Ops::width) {
+                    typename Ops::reg s = Ops::load(a_start + i);
+                    typename Ops::reg e = Ops::load(a_end + i);
+                    typename Ops::reg gap = join<Ops>(s, e, Ops::load(b_start + i), Ops::load(b_end + i));
+                    if constexpr (sizeof(typename Ops::elem) == sizeof(int)) {
+                        gap = Ops::add(gap, join<Ops>(s, e, Ops::load(c_start + i), Ops::load(c_end + i)));
+                        if constexpr (has_d) {
+                            gap = Ops::add(gap, join<Ops>(s, e, Ops::load(d_start + i), Ops::load(d_end + i)));
+                        }
+
+                        distance = Ops::weigh(distance, gap, weights + i);
+                    } else {
+                        distance = Ops::weigh(distance, gap, weights + i);
+                        gap = join<Ops>(s, e, Ops::load(c_start + i), Ops::load(c_end + i));
+                        distance = Ops::weigh(distance, gap, weights + i);
+                        if constexpr (has_d) {
+                            gap = join<Ops>(s, e, Ops::load(d_start + i), Ops::load(d_end + i));
+                            distance = Ops::weigh(distance, gap, weights + i);
+                        }
+                    }
+                }
+
+                int total = Ops::hsum(distance);
+                if constexpr (Ops::width > 1) {
+                    typedef scalar_interval_ops<typename Ops::elem> tail_ops;
+                    total += join_cost<tail_ops, has_d>(a_start + i, a_end + i, b_start + i, b_end + i,
+                                                        c_start + i, c_end + i,
+                                                        has_d ? d_start + i : nullptr,
+                                                        has_d ? d_end + i : nullptr,
+                                                        weights + i, n - i);
+                }
+
+                return total;
+            }
+
+            template <class Ops>
+            void label(const typename Ops::elem* __restrict parent,
+                       const typename Ops::elem* __restrict start, const typename Ops::elem* __restrict end,
+                       typename Ops::elem* __restrict child, size_t n) {
+                size_t i = 0;
+                for (; i + Ops::width <= n; i += Ops::width) {
+                    typename Ops::reg x = Ops::max(Ops::load(parent + i), Ops::load(start + i));
+                    Ops::store(child + i, Ops::min(x, Ops::load(end + i)));
+                }
+
+                if constexpr (Ops::width > 1) {
+                    label<scalar_interval_ops<typename Ops::elem>>(parent + i, start + i, end + i, child + i, n - i);
+                }
+            }
+
+            // the interval kernels instantiated with Ops
+            template <class Ops>
+            constexpr interval_kernels<typename Ops::elem> make_interval_kernels() {
+                return {
+                    merge<Ops>,
+                    merge_point<Ops>,
+                    merge_points<Ops>,
+                    join_cost<Ops, true>,
+                    join_cost<Ops, false>,
+                    label<Ops>
+                };
+            }
+
+            template <class Ops>
+            int l1_distance(const int* __restrict a, const int* __restrict b, size_t n) {
+                typename Ops::reg distance = Ops::zero();
+
+                size_t i = 0;
+                for (; i + Ops::width <= n; i += Ops::width) {
+                    typename Ops::reg x = Ops::load(a + i);
+                    typename Ops::reg y = Ops::load(b + i);
+                    distance = Ops::add(distance, Ops::sub(Ops::max(x, y), Ops::min(x, y)));
+                }
+
+                int total = Ops::hsum(distance);
+                if constexpr (Ops::width > 1) {
+                    total += l1_distance<scalar_ops>(a + i, b + i, n - i);
+                }
+
+                return total;
+            }
+
+            template <typename T>
+            struct scalar_narrow_ops {
+                typedef int reg;
+                typedef T elem;
+                static constexpr size_t width = 1;
+
+                static inline reg load(const T* p) { return *p; }
+                static inline reg zero() { return 0; }
+                static inline reg abs_diff_add(reg acc, reg x, reg y) { return acc + (x < y ? y - x : x - y); }
+                static inline int hsum(reg a) { return a; }
+            };
+
+            template <class Ops>
+            int narrow_l1_distance(const typename Ops::elem* __restrict a,
+                                   const typename Ops::elem* __restrict b, size_t n) {
+                typename Ops::reg distance = Ops::zero();
+
+                size_t i = 0;
+                for (; i + Ops::width <= n; i += Ops::width) {
+                    distance = Ops::abs_diff_add(distance, Ops::load(a + i), Ops::load(b + i));
+                }
+
+                int total = Ops::hsum(distance);
+                if constexpr (Ops::width > 1) {
+                    total += narrow_l1_distance<scalar_narrow_ops<typename Ops::elem>>(a + i, b + i, n - i);
+                }
+
+                return total;
+            }
+        };
+    };
+};
+
+#endif
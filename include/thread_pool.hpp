@@ -0,0 +1,78 @@
+#ifndef _THREAD_POOL_H
+#define _THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+  Fixed size pool of threads executing parallel loops with range
+  based work stealing.
+
+  Each participating thread starts with a contiguous slice of the
+  iteration space and takes grain sized chunks from its front. Once
+  a thread runs out of work it steals the back half of the largest
+  remaining slice, so unevenly priced iterations stay balanced
+  without a shared queue.
+
+  The calling thread participates as worker 0, so a pool of size 1
+  spawns no threads and runs every loop serially. Loops started from
+  inside a running loop are also executed serially by the calling
+  worker.
+*/
+class thread_pool {
+private:
+    // packed [begin, end) of the slice owned by a worker
+    struct alignas(64) slice {
+        std::atomic<uint64_t> bounds;
+    };
+
+    std::vector<std::thread> workers;
+    std::unique_ptr<slice[]> slices;
+
+    std::mutex mutex;
+    std::condition_variable job_ready;
+    std::condition_variable job_done;
+
+    const std::function<void(size_t, size_t)>* job = nullptr;
+    size_t job_grain = 1;
+    uint64_t generation = 0;
+    size_t active = 0;
+    bool stopping = false;
+
+    std::mutex error_mutex;
+    std::exception_ptr error;
+
+    void worker_loop(size_t id);
+    void run(size_t id);
+    bool take(size_t id, size_t& begin, size_t& end);
+    bool steal(size_t id);
+
+public:
+    explicit thread_pool(size_t num_threads);
+    ~thread_pool();
+
+    thread_pool(const thread_pool&) = delete;
+    thread_pool& operator=(const thread_pool&) = delete;
+
+    // number of threads executing a loop, including the caller
+    size_t size() const {
+        return workers.size() + 1;
+    }
+
+    /*
+      Calls f(i, worker) for every i in [0, n) and returns once all
+      calls completed, where worker in [0, size()) identifies the
+      executing thread (e.g. to index thread local scratch space).
+      Rethrows the first exception thrown by f.
+    */
+    void parallel_for(size_t n, const std::function<void(size_t, size_t)>& f, size_t grain = 1);
+};
+
+#endif
@@ -1,13 +1,20 @@
 #include "copy_number.hpp"
+#include "sankoff_kernels.hpp"
 #include "vec_utilities.hpp"
 
+#include <algorithm>
+#include <array>
+#include <chrono>
 #include <cstdlib>
+#include <functional>
 #include <set>
 #include <random>
 #include <vector>
 #include <map>
+#include <queue>
 #include <ostream>
 #include <limits>
+#include <stdexcept>
 
 namespace copynumber {
     namespace {
@@ -22,83 +29,116 @@ namespace copynumber {
         return os;
     }
 
-    breakpoint_profile convert_to_breakpoint_profile(const copynumber_profile &p, int diploid_cn) {
-        std::map<std::pair<std::string, std::string>, copynumber_profile> chrom_allele_profiles;
-        for (size_t i = 0; i < p.bins.size(); i++) {
-            auto chrom_allele = std::make_pair(p.bins[i].chromosome, p.bins[i].allele);
-            if (!chrom_allele_profiles.count(chrom_allele)) {
-                chrom_allele_profiles[chrom_allele] = copynumber_profile();
+    namespace {
+        // values of a profile in sorted bin order, gathered into buffer if need be
+        const int* gather(const bin_order& order, const int* values, std::vector<int>& buffer) {
+            if (order.permutation.empty()) return values;
+
+            buffer.resize(order.permutation.size());
+            for (size_t i = 0; i < buffer.size(); i++) {
+                buffer[i] = values[order.permutation[i]];
             }
 
-            chrom_allele_profiles[chrom_allele].bins.push_back(p.bins[i]);
-            chrom_allele_profiles[chrom_allele].profile.push_back(p.profile[i]);
+            return buffer.data();
         }
 
-        breakpoint_profile bp;
-        for (const auto &[chrom_allele, cn_profile] : chrom_allele_profiles) {
-            std::vector<size_t> index_vector = argsort(cn_profile.bins);
-            std::vector<genomic_bin> bins = select(cn_profile.bins, index_vector);
-            std::vector<int> profile = select(cn_profile.profile, index_vector);
-
-            std::vector<int> bp_profile(profile.size());
-            for (size_t i = 0; i < profile.size(); i++) {
-                if (i == 0) {
-                    bp_profile[i] = profile[i] - diploid_cn;
-                } else if (i == profile.size() - 1) {
-                    bp_profile[i] = diploid_cn - profile[i];
-                } else {
-                    bp_profile[i] = profile[i] - profile[i - 1];
+        void to_breakpoints(const bin_order& order, const int* cn, int* bp, int diploid_cn) {
+            for (size_t s = 0; s + 1 < order.segment_starts.size(); s++) {
+                size_t start = order.segment_starts[s], end = order.segment_starts[s + 1];
+                bp[start] = cn[start] - diploid_cn;
+                for (size_t i = start + 1; i + 1 < end; i++) {
+                    bp[i] = cn[i] - cn[i - 1];
                 }
 
-                bp.profile.push_back(bp_profile[i]);
-                bp.bins.push_back(bins[i]);
+                if (end - start > 1) bp[end - 1] = diploid_cn - cn[end - 1];
             }
         }
 
-        return bp;
-    }
+        void to_copy_numbers(const bin_order& order, const int* bp, int* cn, int diploid_cn) {
+            for (size_t s = 0; s + 1 < order.segment_starts.size(); s++) {
+                size_t start = order.segment_starts[s], end = order.segment_starts[s + 1];
+                cn[start] = bp[start] + diploid_cn;
+                for (size_t i = start + 1; i + 1 < end; i++) {
+                    cn[i] = bp[i] + cn[i - 1];
+                }
 
-    copynumber_profile convert_to_copynumber_profile(const breakpoint_profile &p, int diploid_cn) {
-        std::map<std::pair<std::string, std::string>, breakpoint_profile> chrom_allele_profiles;
-        for (size_t i = 0; i < p.bins.size(); i++) {
-            auto chrom_allele = std::make_pair(p.bins[i].chromosome, p.bins[i].allele);
-            if (!chrom_allele_profiles.count(chrom_allele)) {
-                chrom_allele_profiles[chrom_allele] = breakpoint_profile();
+                if (end - start > 1) cn[end - 1] = diploid_cn - bp[end - 1];
             }
-
-            chrom_allele_profiles[chrom_allele].bins.push_back(p.bins[i]);
-            chrom_allele_profiles[chrom_allele].profile.push_back(p.profile[i]);
         }
+    }
 
-        copynumber_profile cn;
-        for (const auto &[chrom_allele, bp_profile] : chrom_allele_profiles) {
-            std::vector<size_t> index_vector = argsort(bp_profile.bins);
-            std::vector<genomic_bin> bins = select(bp_profile.bins, index_vector);
-            std::vector<int> profile = select(bp_profile.profile, index_vector);
-
-            std::vector<int> cn_profile(profile.size());
-            for (size_t i = 0; i < profile.size(); i++) {
-                if (i == 0) {
-                    cn_profile[i] = profile[i] + diploid_cn;
-                } else if (i == profile.size() - 1) {
-                    cn_profile[i] = diploid_cn - profile[i];
-                } else {
-                    cn_profile[i] = profile[i] + cn_profile[i - 1];
-                }
+    /*
+      Lexicographically sorting all bins orders them by chromosome
+      and allele first, and then by position within each segment.
+     */
+    bin_order sort_bins(const shared_bin_table& bins) {
+        bin_order order;
+        if (std::is_sorted(bins->begin(), bins->end())) {
+            order.sorted_bins = bins;
+        } else {
+            order.permutation = argsort(*bins);
+            order.sorted_bins = make_bin_table(select(*bins, order.permutation));
+        }
 
-                cn.profile.push_back(cn_profile[i]);
-                cn.bins.push_back(bins[i]);
+        const std::vector<genomic_bin>& sorted = *order.sorted_bins;
+        for (size_t i = 0; i < sorted.size(); i++) {
+            if (i == 0 || sorted[i].chromosome != sorted[i - 1].chromosome || sorted[i].allele != sorted[i - 1].allele) {
+                order.segment_starts.push_back(i);
             }
         }
 
+        order.segment_starts.push_back(sorted.size());
+        return order;
+    }
+
+    breakpoint_profile convert_to_breakpoint_profile(const copynumber_profile &p, const bin_order& order, int diploid_cn) {
+        std::vector<int> buffer;
+        breakpoint_profile bp(std::vector<int>(p.profile.size()), order.sorted_bins);
+        to_breakpoints(order, gather(order, p.profile.data(), buffer), bp.profile.data(), diploid_cn);
+        return bp;
+    }
+
+    copynumber_profile convert_to_copynumber_profile(const breakpoint_profile &p, const bin_order& order, int diploid_cn) {
+        std::vector<int> buffer;
+        copynumber_profile cn(std::vector<int>(p.profile.size()), order.sorted_bins);
+        to_copy_numbers(order, gather(order, p.profile.data(), buffer), cn.profile.data(), diploid_cn);
         return cn;
     }
+
+    breakpoint_profile convert_to_breakpoint_profile(const copynumber_profile &p, int diploid_cn) {
+        return convert_to_breakpoint_profile(p, sort_bins(p.bins), diploid_cn);
+    }
+
+    copynumber_profile convert_to_copynumber_profile(const breakpoint_profile &p, int diploid_cn) {
+        return convert_to_copynumber_profile(p, sort_bins(p.bins), diploid_cn);
+    }
+
+    breakpoint_matrix convert_to_breakpoint_matrix(const copynumber_matrix& m, int diploid_cn, thread_pool* pool) {
+        bin_order order = sort_bins(make_bin_table(m.bins));
+        std::vector<size_t> rows = argsort(m.cells);
+        breakpoint_matrix bp(select(m.cells, rows), order.sorted_bins);
+
+        std::vector<std::vector<int>> buffers(pool != nullptr ? pool->size() : 1);
+        auto convert_row = [&](size_t i, size_t worker) {
+            const int* cn = gather(order, m.row(rows[i]), buffers[worker]);
+            to_breakpoints(order, cn, bp.row(i), diploid_cn);
+        };
+
+        if (pool != nullptr) {
+            pool->parallel_for(rows.size(), convert_row);
+        } else {
+            for (size_t i = 0; i < rows.size(); i++) convert_row(i, 0);
+        }
+
+        return bp;
+    }
+
     /*
       Computes the breakpoint magnitude of a *chromosome and allele
       sorted* breakpoint profile.
      */
     int breakpoint_magnitude(const breakpoint_profile& p) {
-        if (p.bins.size() < 1) return 0;
+        if (p.profile.size() < 1) return 0;
 
         int mag = 0;
         for (std::vector<int>::size_type i = 0; i < p.profile.size(); i++) {
@@ -125,106 +165,357 @@ namespace copynumber {
         return out_interval;
     }
 
-    std::tuple<std::vector<int>, std::vector<int>, int> sankoff(const rectilinear_vertex_data& u, const rectilinear_vertex_data& v) {
-        const std::vector<int> &u_start = u.start.value();
-        const std::vector<int> &u_end = u.end.value();
-        const std::vector<int> &v_start = v.start.value();
-        const std::vector<int> &v_end = v.end.value();
+    namespace {
+        // bins scored between checks against the ceiling of nni_score
+        constexpr size_t score_chunk = 1024;
+
+        // shards span whole cache lines, so no two shards write to the same line
+        constexpr size_t shard_alignment = 16;
+        constexpr size_t min_shard_bins = 2048;
+
+        /*
+          Merges bins [begin, end) of row a of arena in_a with those of
+          row b of arena in_b into row out_row of arena out, returning
+          the weighted distance over these bins. Point rows (i.e. leaves)
+          are merged by the cheaper point kernels.
+         */
+        int merge_rows(const rectilinear_tree& t,
+                       const interval_arena& in_a, int a,
+                       const interval_arena& in_b, int b,
+                       interval_arena& out, int out_row,
+                       size_t begin, size_t end) {
+            return visit_interval_type(out.type(), [&](auto type) {
+                typedef decltype(type) T;
+                const kernels::interval_kernels<T>& table = kernels::dispatch().intervals<T>();
+                const int* weights = t.patterns->weights.data();
+                bool a_point = in_a.is_point(a), b_point = in_b.is_point(b);
+
+                int distance = 0;
+                for (size_t k = 0; k < out.num_blocks(); k++) {
+                    size_t block_begin = out.block_begin(k), block_end = block_begin + out.block_size(k);
+                    size_t lo = std::max(begin, block_begin), hi = std::min(end, block_end);
+                    if (lo >= hi) continue;
+
+                    size_t offset = lo - block_begin;
+                    T* start = out.start<T>(out_row, k) + offset;
+                    T* end = out.end<T>(out_row, k) + offset;
+                    if (a_point && b_point) {
+                        distance += table.merge_points(in_a.start<T>(a, k) + offset, in_b.start<T>(b, k) + offset,
+                                                       weights + lo, start, end, hi - lo);
+                    } else if (a_point || b_point) {
+                        const interval_arena& in_p = a_point ? in_a : in_b;
+                        const interval_arena& in_v = a_point ? in_b : in_a;
+                        int p = a_point ? a : b, v = a_point ? b : a;
+                        distance += table.merge_point(in_p.start<T>(p, k) + offset,
+                                                      in_v.start<T>(v, k) + offset, in_v.end<T>(v, k) + offset,
+                                                      weights + lo, start, end, hi - lo);
+                    } else {
+                        distance += table.merge(in_a.start<T>(a, k) + offset, in_a.end<T>(a, k) + offset,
+                                                in_b.start<T>(b, k) + offset, in_b.end<T>(b, k) + offset,
+                                                weights + lo, start, end, hi - lo);
+                    }
+                }
 
-        std::vector<int> start(u_start.size());
-        std::vector<int> end(u_end.size());
-        int distance = 0;
-        for (size_t i = 0; i < u_start.size(); i++) {
-            std::optional<std::pair<int, int>> interval = overlap(u_start[i], u_end[i], v_start[i], v_end[i]);
+                return distance;
+            });
+        }
 
-            if (interval) {
-                auto [s, e] = interval.value();
-                start[i] = s;
-                end[i] = e;
-            } else {
-                if (u_start[i] < v_start[i]) {
-                    start[i] = u_end[i];
-                    end[i] = v_start[i];
-                } else {
-                    start[i] = v_end[i];
-                    end[i] = u_start[i];
-                }
+        int merge_rows(const rectilinear_tree& t,
+                       const interval_arena& in_a, int a,
+                       const interval_arena& in_b, int b,
+                       interval_arena& out, int out_row) {
+            return merge_rows(t, in_a, a, in_b, b, out, out_row, 0, out.bins());
+        }
 
-                distance += end[i] - start[i];
+        /*
+          Splits [0, bins) into at most one shard per worker of the
+          pool, each of at least min_shard_bins bins, returning the
+          shard boundaries.
+         */
+        std::vector<size_t> bin_shards(size_t bins, const thread_pool* pool) {
+            size_t num_shards = pool == nullptr ? 1 : std::min(pool->size(), bins / min_shard_bins);
+            num_shards = std::max<size_t>(num_shards, 1);
+
+            size_t width = (bins + num_shards - 1) / num_shards;
+            width = (width + shard_alignment - 1) / shard_alignment * shard_alignment;
+
+            std::vector<size_t> boundaries = {0};
+            while (boundaries.back() < bins) {
+                boundaries.push_back(std::min(bins, boundaries.back() + width));
             }
+
+            if (boundaries.size() == 1) boundaries.push_back(bins);
+            return boundaries;
         }
 
-        return std::make_tuple(start, end, distance);
+        /*
+          Calls f(shard, begin, end) for every shard of bins, on the
+          pool if there is more than one.
+         */
+        void for_each_shard(const std::vector<size_t>& shards, thread_pool* pool,
+                            const std::function<void(size_t, size_t, size_t)>& f) {
+            size_t num_shards = shards.size() - 1;
+            if (num_shards == 1 || pool == nullptr) {
+                for (size_t i = 0; i < num_shards; i++) f(i, shards[i], shards[i + 1]);
+                return;
+            }
+
+            pool->parallel_for(num_shards, [&](size_t i, size_t) {
+                f(i, shards[i], shards[i + 1]);
+            });
+        }
     }
 
+    int sankoff(rectilinear_tree& t, int u, int v, int parent) {
+        return merge_rows(t, t.intervals, u, t.intervals, v, t.intervals, parent);
+    }
 
-    /*
-      Returns the optimal labeling of the child given the parent
-      labeling and the set of optimal labelings for the child.
-     */
-    std::vector<int> local_labeling(const std::vector<int>& parent_labeling,
-                                    const std::vector<int>& child_start,
-                                    const std::vector<int>& child_end) {
-        std::vector<int> child_labeling(parent_labeling.size());
-        for (size_t i = 0; i < child_labeling.size(); i++) {
-            // parent labeling overlaps with optimal child labelings
-            if (child_start[i] <= parent_labeling[i] && parent_labeling[i] <= child_end[i]) {
-                child_labeling[i] = parent_labeling[i];
-            } else {
-                int dist1 = abs(parent_labeling[i] - child_start[i]);
-                int dist2 = abs(parent_labeling[i] - child_end[i]);
-                if (dist1 < dist2) {
-                    child_labeling[i] = child_start[i];
-                } else {
-                    child_labeling[i] = child_end[i];
-                }
+    interval_arena inside_arena(const binary_tree<rectilinear_vertex_data>& tree, size_t bins, arena_layout layout,
+                                interval_type type) {
+        std::vector<bool> leaves(tree.size());
+        for (size_t u = 0; u < tree.size(); u++) {
+            leaves[u] = tree.is_leaf(u);
+        }
+
+        return interval_arena(leaves, bins, layout, interval_arena::default_block_width, type);
+    }
+
+    std::vector<int> site_patterns::compress(const std::vector<int>& profile) const {
+        return select(profile, representative);
+    }
+
+    std::vector<int> site_patterns::expand(const std::vector<int>& pattern_profile) const {
+        return select(pattern_profile, pattern_of_bin);
+    }
+
+    breakpoint_matrix make_breakpoint_matrix(const std::map<std::string, breakpoint_profile>& profiles) {
+        std::vector<std::string> names;
+        for (const auto& [name, _] : profiles) {
+            names.push_back(name);
+        }
+
+        shared_bin_table bins = make_bin_table({});
+        if (!profiles.empty()) bins = profiles.begin()->second.bins;
+
+        breakpoint_matrix m(names, bins);
+
+        size_t i = 0;
+        for (const auto& [name, p] : profiles) {
+            if (p.profile.size() != bins->size()) {
+                throw std::runtime_error("profile of " + name + " has a different number of bins");
             }
+
+            std::copy(p.profile.begin(), p.profile.end(), m.row(i++));
         }
 
-        return child_labeling;
+        return m;
     }
 
-    digraph<breakpoint_profile_vertex_data> ancestral_labeling(digraph<rectilinear_vertex_data>& t,
-                                                               int root,
-                                                               std::vector<genomic_bin> bins) {
-        std::stack<std::tuple<int, int>> callstack;
-        digraph<breakpoint_profile_vertex_data> bt;
+    site_patterns find_site_patterns(const breakpoint_matrix& profiles) {
+        site_patterns patterns;
+        if (profiles.rows() == 0) return patterns;
 
-        callstack.push(std::make_tuple(root, -1));
-        while (!callstack.empty()) {
-            auto [node, parent] = callstack.top();
-            callstack.pop();
+        size_t num_bins = profiles.bins();
+        std::vector<std::vector<int>> columns(num_bins, std::vector<int>(profiles.rows()));
+        for (size_t j = 0; j < profiles.rows(); j++) {
+            const int* row = profiles.row(j);
+            for (size_t i = 0; i < num_bins; i++) {
+                columns[i][j] = row[i];
+            }
+        }
 
-            breakpoint_profile_vertex_data d;
-            d.name = t[node].data.name; // copy node name
+        std::map<std::vector<int>, size_t> pattern_index;
+        patterns.pattern_of_bin.resize(num_bins);
+        for (size_t i = 0; i < num_bins; i++) {
+            auto [it, inserted] = pattern_index.try_emplace(std::move(columns[i]), patterns.weights.size());
+            if (inserted) {
+                patterns.weights.push_back(0);
+                patterns.representative.push_back(i);
+            }
+
+            patterns.weights[it->second]++;
+            patterns.pattern_of_bin[i] = it->second;
+        }
+
+        return patterns;
+    }
+
+
+    namespace {
+        /*
+          Labels every vertex with optimal site pattern values by a
+          top-down pass over the intervals, indexed by vertex. Labels
+          are computed in the storage type of the intervals, where the
+          label of a child is the value of its optimal interval closest
+          to the label of its parent.
+         */
+        std::vector<std::vector<int>> pattern_labelings(const rectilinear_tree& t, int root) {
+            const interval_arena& in = t.intervals;
+            size_t block_width = in.num_blocks() == 0 ? 1 : in.block_size(0);
+            interval_arena labels(std::vector<bool>(t.tree.size(), true), in.bins(), in.layout(), block_width, in.type());
+
+            std::vector<std::vector<int>> labelings(t.tree.size());
+            visit_interval_type(in.type(), [&](auto type) {
+                typedef decltype(type) T;
+                const kernels::interval_kernels<T>& table = kernels::dispatch().intervals<T>();
+
+                std::stack<int> callstack;
+                callstack.push(root);
+                while (!callstack.empty()) {
+                    int node = callstack.top();
+                    callstack.pop();
+
+                    for (size_t b = 0; b < in.num_blocks(); b++) {
+                        if (node == root) {
+                            std::copy(in.start<T>(node, b), in.start<T>(node, b) + in.block_size(b),
+                                      labels.start<T>(node, b));
+                        } else {
+                            table.label(labels.start<T>(t.tree.parent(node), b),
+                                        in.start<T>(node, b), in.end<T>(node, b),
+                                        labels.start<T>(node, b), in.block_size(b));
+                        }
+                    }
+
+                    labelings[node].resize(in.bins());
+                    labels.copy_start(node, labelings[node].data());
+
+                    if (t.tree.is_leaf(node)) continue;
+                    for (int child : t.tree.children(node)) {
+                        callstack.push(child);
+                    }
+                }
+            });
+
+            return labelings;
+        }
+
+        digraph<breakpoint_profile_vertex_data> labeled_tree(const rectilinear_tree& t,
+                                                             int root,
+                                                             const site_patterns& patterns,
+                                                             const shared_bin_table& bins,
+                                                             const std::vector<std::vector<int>>& labelings) {
+            std::stack<std::tuple<int, int>> callstack;
+            digraph<breakpoint_profile_vertex_data> bt;
+
+            callstack.push(std::make_tuple(root, -1));
+            while (!callstack.empty()) {
+                auto [node, parent] = callstack.top();
+                callstack.pop();
+
+                breakpoint_profile_vertex_data d;
+                d.name = t.tree[node].name; // copy node name
 
-            if (parent == -1) {
-                breakpoint_profile p;
-                p.bins = bins;
-                p.profile = t[node].data.start.value();
-                d.profile = p;
-            } else {
                 breakpoint_profile p;
                 p.bins = bins;
-                p.profile = local_labeling(bt[parent].data.profile.profile, t[node].data.start.value(), t[node].data.end.value());
+                p.profile = patterns.expand(labelings[node]);
                 d.profile = p;
-                d.in_branch_length = breakpoint_magnitude(p - bt[parent].data.profile);
+                if (parent != -1) {
+                    d.in_branch_length = breakpoint_magnitude(p - bt[parent].data.profile);
+                }
+
+                int new_node = bt.add_vertex(d);
+                if (parent != -1) {
+                    bt.add_edge(parent, new_node);
+                }
+
+                if (t.tree.is_leaf(node)) continue;
+                for (int child : t.tree.children(node)) {
+                    callstack.push(std::make_tuple(child, new_node));
+                }
             }
 
-            int new_node = bt.add_vertex(d);
-            if (parent != -1) {
-                bt.add_edge(parent, new_node);
+            return bt;
+        }
+    }
+
+    digraph<breakpoint_profile_vertex_data> ancestral_labeling(rectilinear_tree& t,
+                                                               int root,
+                                                               const shared_bin_table& bins) {
+        return labeled_tree(t, root, *t.patterns, bins, pattern_labelings(t, root));
+    }
+
+    digraph<breakpoint_profile_vertex_data> ancestral_labeling(rectilinear_tree& t,
+                                                               int root,
+                                                               const shared_bin_table& bins,
+                                                               const pattern_blocks& blocks,
+                                                               thread_pool* pool) {
+        size_t num_patterns = blocks.patterns()->num_patterns();
+        std::vector<std::vector<int>> labelings(t.tree.size(), std::vector<int>(num_patterns));
+        for (size_t b = 0; b < blocks.num_blocks(); b++) {
+            blocks.load(t, b);
+            small_rectilinear(t, root, pool);
+
+            size_t begin = blocks.block_begin(b);
+            size_t n = std::min(blocks.block_width(), num_patterns - begin);
+            std::vector<std::vector<int>> block_labelings = pattern_labelings(t, root);
+            for (size_t u = 0; u < t.tree.size(); u++) {
+                if (block_labelings[u].empty()) continue; // not below root
+                std::copy(block_labelings[u].begin(), block_labelings[u].begin() + n, labelings[u].begin() + begin);
             }
+        }
+
+        return labeled_tree(t, root, *blocks.patterns(), bins, labelings);
+    }
+
+    void small_rectilinear(rectilinear_tree& t, int root, thread_pool* pool) {
+        /* Finds the vertices to recompute, children before parents */
+        std::vector<int> order;
+        std::stack<std::pair<int, bool>> callstack;
 
-            for (const auto& child : t.successors(node)) {
-                callstack.push(std::make_tuple(child, new_node));
+        callstack.push(std::make_pair(root, false));
+        while (!callstack.empty()) {
+            auto [node, expanded] = callstack.top();
+            callstack.pop();
+
+            if (t.tree.is_leaf(node)) {
+                t.tree[node].visited = true;
+                continue;
             }
+
+            if (expanded) {
+                order.push_back(node);
+                continue;
+            }
+
+            // check condition that every node has two children
+            if (t.tree.out_degree(node) != 2)
+                throw std::logic_error("every child must have exactly two children");
+
+            int u = t.tree.left(node);
+            int v = t.tree.right(node);
+
+            callstack.push(std::make_pair(node, true));
+            if (!t.tree[u].visited) callstack.push(std::make_pair(u, false));
+            if (!t.tree[v].visited) callstack.push(std::make_pair(v, false));
         }
 
-        return bt;
+        /* Merges every shard of bins up the tree independently */
+        std::vector<size_t> shards = bin_shards(t.intervals.bins(), pool);
+        std::vector<int> costs((shards.size() - 1) * order.size());
+        for_each_shard(shards, pool, [&](size_t shard, size_t begin, size_t end) {
+            int* shard_costs = costs.data() + shard * order.size();
+            for (size_t i = 0; i < order.size(); i++) {
+                int node = order[i];
+                shard_costs[i] = merge_rows(t, t.intervals, t.tree.left(node), t.intervals, t.tree.right(node),
+                                            t.intervals, node, begin, end);
+            }
+        });
+
+        for (size_t i = 0; i < order.size(); i++) {
+            int node = order[i];
+            int cost = 0;
+            for (size_t shard = 0; shard + 1 < shards.size(); shard++) {
+                cost += costs[shard * order.size() + i];
+            }
+
+            t.tree[node].score = cost + t.tree[t.tree.left(node)].score + t.tree[t.tree.right(node)].score;
+            t.tree[node].visited = true;
+        }
     }
 
-    void small_rectilinear(digraph<rectilinear_vertex_data>& t, int root) {
+    void outside_rectilinear(rectilinear_tree& t, int root, thread_pool* pool) {
+        /* Lists the (child, sibling) pairs below each vertex, parents before children */
+        std::vector<std::tuple<int, int, int>> order;
         std::stack<int> callstack;
 
         callstack.push(root);
@@ -232,224 +523,1244 @@ namespace copynumber {
             int node = callstack.top();
             callstack.pop();
 
-            if (t.out_degree(node) == 0) {
-                t[node].data.visited = true;
-                continue;
+            if (t.tree.is_leaf(node)) continue;
+
+            int u = t.tree.left(node);
+            int v = t.tree.right(node);
+            for (auto [child, sibling] : {std::make_pair(u, v), std::make_pair(v, u)}) {
+                if (node == root) {
+                    t.outside.copy_row(child, t.intervals, sibling);
+                    t.tree[child].outside_score = t.tree[sibling].score;
+                } else {
+                    order.push_back(std::make_tuple(node, child, sibling));
+                }
+
+                callstack.push(child);
             }
+        }
 
-            // check condition that every node has two children
-            if (t.out_degree(node) != 2)
-                throw std::logic_error("every child must have exactly two children");
+        std::vector<size_t> shards = bin_shards(t.intervals.bins(), pool);
+        std::vector<int> costs((shards.size() - 1) * order.size());
+        for_each_shard(shards, pool, [&](size_t shard, size_t begin, size_t end) {
+            int* shard_costs = costs.data() + shard * order.size();
+            for (size_t i = 0; i < order.size(); i++) {
+                auto [node, child, sibling] = order[i];
+                shard_costs[i] = merge_rows(t, t.outside, node, t.intervals, sibling, t.outside, child, begin, end);
+            }
+        });
 
-            // check to see if all children are visited
-            bool children_visited = true; 
-            for (const auto& child : t.successors(node)) {
-                if (!t[child].data.visited) children_visited = false;
+        for (size_t i = 0; i < order.size(); i++) {
+            auto [node, child, sibling] = order[i];
+            int cost = 0;
+            for (size_t shard = 0; shard + 1 < shards.size(); shard++) {
+                cost += costs[shard * order.size() + i];
             }
 
-            if (children_visited) {
-                // grab two children
-                std::set<int> children_s = t.successors(node);
-                std::vector<int> children_a(children_s.begin(), children_s.end());
+            t.tree[child].outside_score = cost + t.tree[node].outside_score + t.tree[sibling].score;
+        }
+    }
 
-                /* could wrap this into "Sankoff" sub-routine */
-                int u = children_a[0];
-                int v = children_a[1];
+    void small_rectilinear(rectilinear_tree& t, int root, const pattern_blocks& blocks, thread_pool* pool) {
+        std::vector<int> scores(t.tree.size(), 0);
+        for (size_t b = 0; b < blocks.num_blocks(); b++) {
+            blocks.load(t, b);
+            small_rectilinear(t, root, pool);
+            for (size_t u = 0; u < t.tree.size(); u++) {
+                scores[u] += t.tree[u].score;
+            }
+        }
+
+        for (size_t u = 0; u < t.tree.size(); u++) {
+            t.tree[u].score = scores[u];
+        }
+    }
+
+    pattern_blocks::pattern_blocks(std::shared_ptr<const site_patterns> patterns, size_t num_vertices, size_t block_width) :
+        patterns_(std::move(patterns)), width(block_width), leaf_row(num_vertices, -1) {
+        if (width == 0) {
+            throw std::invalid_argument("block width must be positive");
+        }
 
-                const rectilinear_vertex_data& u_data = t[u].data;
-                const rectilinear_vertex_data& v_data = t[v].data;
+        size_t num_patterns = patterns_->num_patterns();
+        nblocks = std::max<size_t>(1, (num_patterns + width - 1) / width);
+        for (size_t b = 0; b < nblocks; b++) {
+            auto block = std::make_shared<site_patterns>();
+            block->weights.assign(width, 0);
+            for (size_t i = b * width; i < std::min(num_patterns, (b + 1) * width); i++) {
+                block->weights[i - b * width] = patterns_->weights[i];
+            }
 
-                const auto& [start, end, cost] = sankoff(u_data, v_data);
+            block_patterns.push_back(block);
+        }
+    }
 
-                t[node].data.score = cost + u_data.score + v_data.score;
-                t[node].data.start = start;
-                t[node].data.end = end;
-                t[node].data.visited = true;
+    void pattern_blocks::set_point(size_t u, const int* point) {
+        if (leaf_row[u] == -1) {
+            leaf_row[u] = values.size() / (nblocks * width);
+            values.resize(values.size() + nblocks * width, 0);
+        }
 
+        std::copy(point, point + patterns_->num_patterns(), values.begin() + leaf_row[u] * nblocks * width);
+    }
+
+    void pattern_blocks::load(rectilinear_tree& t, size_t block) const {
+        if (t.intervals.bins() != width || t.intervals.rows() != t.tree.size()) {
+            t.intervals = inside_arena(t.tree, width, t.intervals.layout(), t.intervals.type());
+            t.outside = interval_arena(t.tree.size(), width, t.outside.layout(),
+                                       interval_arena::default_block_width, t.outside.type());
+        }
+
+        t.patterns = block_patterns[block];
+        for (size_t u = 0; u < t.tree.size(); u++) {
+            t.tree[u].visited = false;
+            if (leaf_row[u] == -1) continue;
+            t.intervals.set_point(u, values.data() + leaf_row[u] * nblocks * width + block * width);
+        }
+    }
+
+    int nni_score(const rectilinear_tree& t, int root, int u, int w, int v, int z, int ceiling) {
+        const interval_arena& in = t.intervals;
+        const interval_arena& out = t.outside;
+        const int* weights = t.patterns->weights.data();
+
+        // after the move v has children w and x, and u has children v and z
+        int x = t.tree.left(v) == z ? t.tree.right(v) : t.tree.left(v);
+
+        int score = t.tree[w].score + t.tree[x].score + t.tree[z].score;
+        if (u != root) score += t.tree[u].outside_score;
+
+        // costs are non-negative, so the partial score bounds the final one
+        visit_interval_type(in.type(), [&](auto type) {
+            typedef decltype(type) T;
+            const kernels::interval_kernels<T>& table = kernels::dispatch().intervals<T>();
+            for (size_t b = 0; b < in.num_blocks(); b++) {
+                for (size_t i = 0; i < in.block_size(b) && score < ceiling; i += score_chunk) {
+                    size_t n = std::min(score_chunk, in.block_size(b) - i);
+                    if (u == root) {
+                        score += table.triplet_cost(in.start<T>(w, b) + i, in.end<T>(w, b) + i,
+                                                    in.start<T>(x, b) + i, in.end<T>(x, b) + i,
+                                                    in.start<T>(z, b) + i, in.end<T>(z, b) + i,
+                                                    nullptr, nullptr,
+                                                    weights + in.block_begin(b) + i, n);
+                    } else {
+                        score += table.quartet_cost(in.start<T>(w, b) + i, in.end<T>(w, b) + i,
+                                                    in.start<T>(x, b) + i, in.end<T>(x, b) + i,
+                                                    in.start<T>(z, b) + i, in.end<T>(z, b) + i,
+                                                    out.start<T>(u, b) + i, out.end<T>(u, b) + i,
+                                                    weights + in.block_begin(b) + i, n);
+                    }
+                }
+            }
+        });
+
+        return score;
+    }
+
+    void rescore_nni(rectilinear_tree& t, int root, int u, int v) {
+        interval_arena& in = t.intervals;
+        const int* weights = t.patterns->weights.data();
+
+        int old_score = t.tree[u].score;
+        std::vector<int> old_start(in.bins()), old_end(in.bins());
+        in.copy_start(u, old_start.data());
+        in.copy_end(u, old_end.data());
+
+        for (int node : {v, u}) {
+            int cost = sankoff(t, t.tree.left(node), t.tree.right(node), node);
+            t.tree[node].score = cost + t.tree[t.tree.left(node)].score + t.tree[t.tree.right(node)].score;
+            t.tree[node].visited = true;
+        }
+
+        visit_interval_type(in.type(), [&](auto type) {
+            typedef decltype(type) T;
+
+            /* Bins of u whose interval changed, along with their old intervals */
+            std::vector<size_t> dirty;
+            std::vector<std::pair<int, int>> old_intervals;
+            for (size_t i = 0; i < in.bins(); i++) {
+                if (in.start_at<T>(u, i) != old_start[i] || in.end_at<T>(u, i) != old_end[i]) {
+                    dirty.push_back(i);
+                    old_intervals.push_back(std::make_pair(old_start[i], old_end[i]));
+                }
+            }
+
+            int delta = t.tree[u].score - old_score;
+            std::vector<size_t> next_dirty;
+            std::vector<std::pair<int, int>> next_old_intervals;
+            for (int child = u; child != root && (!dirty.empty() || delta != 0); child = t.tree.parent(child)) {
+                int node = t.tree.parent(child);
+                int sibling = t.tree.sibling(child);
+
+                next_dirty.clear();
+                next_old_intervals.clear();
+                for (size_t k = 0; k < dirty.size(); k++) {
+                    size_t i = dirty[k];
+                    auto [child_start, child_end] = old_intervals[k];
+                    int s = in.start_at<T>(sibling, i), e = in.end_at<T>(sibling, i);
+                    int new_start = in.start_at<T>(child, i), new_end = in.end_at<T>(child, i);
+
+                    // gap between the child and sibling intervals before and after
+                    int old_gap = std::max(0, std::max(child_start, s) - std::min(child_end, e));
+                    int new_lo = std::max(new_start, s), new_hi = std::min(new_end, e);
+                    delta += weights[i] * (std::max(0, new_lo - new_hi) - old_gap);
+
+                    int merged_start = std::min(new_lo, new_hi), merged_end = std::max(new_lo, new_hi);
+                    if (merged_start != in.start_at<T>(node, i) || merged_end != in.end_at<T>(node, i)) {
+                        next_dirty.push_back(i);
+                        next_old_intervals.push_back(std::make_pair(in.start_at<T>(node, i), in.end_at<T>(node, i)));
+                        in.start_at<T>(node, i) = merged_start;
+                        in.end_at<T>(node, i) = merged_end;
+                    }
+                }
+
+                t.tree[node].score += delta;
+                t.tree[node].visited = true;
+                std::swap(dirty, next_dirty);
+                std::swap(old_intervals, next_old_intervals);
+            }
+        });
+    }
+
+    namespace {
+        // the splitmix64 finalizer
+        uint64_t mix(uint64_t x) {
+            x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+            x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+            return x ^ (x >> 31);
+        }
+
+        // recomputes the clade of v from its children, updating the topology hash
+        void update_clade(rectilinear_tree& t, int v) {
+            uint64_t clade = t.tree[t.tree.left(v)].clade ^ t.tree[t.tree.right(v)].clade;
+            t.topology ^= mix(t.tree[v].clade) ^ mix(clade);
+            t.tree[v].clade = clade;
+        }
+    }
+
+    void hash_topology(rectilinear_tree& t) {
+        t.topology = 0;
+        std::stack<std::pair<int, bool>> callstack;
+        callstack.push(std::make_pair(0, false));
+        while (!callstack.empty()) {
+            auto [node, expanded] = callstack.top();
+            callstack.pop();
+
+            if (t.tree.is_leaf(node)) {
+                t.tree[node].clade = mix(0x9e3779b97f4a7c15ULL + node);
+            } else if (!expanded) {
+                callstack.push(std::make_pair(node, true));
+                callstack.push(std::make_pair(t.tree.left(node), false));
+                callstack.push(std::make_pair(t.tree.right(node), false));
                 continue;
+            } else {
+                t.tree[node].clade = t.tree[t.tree.left(node)].clade ^ t.tree[t.tree.right(node)].clade;
+            }
+
+            t.topology ^= mix(t.tree[node].clade);
+        }
+    }
+
+    topology_cache::topology_cache(size_t capacity) :
+        shard_capacity(std::max<size_t>(1, (capacity + num_shards - 1) / num_shards)) {}
+
+    bool topology_cache::contains(uint64_t topology) {
+        shard& s = shards[topology % num_shards];
+        std::lock_guard<std::mutex> lock(s.mutex);
+        return s.topologies.count(topology) > 0;
+    }
+
+    void topology_cache::insert(uint64_t topology) {
+        shard& s = shards[topology % num_shards];
+        std::lock_guard<std::mutex> lock(s.mutex);
+        if (!s.topologies.insert(topology).second) return;
+
+        s.insertion_order.push_back(topology);
+        if (s.insertion_order.size() > shard_capacity) {
+            s.topologies.erase(s.insertion_order.front());
+            s.insertion_order.pop_front();
+        }
+    }
+
+    void nni(rectilinear_tree& t, int u, int w, int v, int z) {
+        t.tree.swap_subtrees(u, w, v, z);
+        update_clade(t, v);
+    }
+
+    void undo_nni(rectilinear_tree& t, int u, int w, int v, int z) {
+        t.tree.swap_subtrees(u, z, v, w);
+        update_clade(t, v);
+    }
+
+    void spr(rectilinear_tree& t, int p, int y) {
+        t.tree.prune_regraft(p, y);
+        hash_topology(t);
+    }
+
+    namespace {
+        // a row of intervals along with the score of the tree they belong to
+        struct interval_ref {
+            const interval_arena* arena;
+            int row;
+            int score;
+        };
+
+        /*
+          Walks the regraft edges around a pruned subtree p, whose
+          intervals are given by pruned. The pruned tree is t without
+          p, with its parent q spliced out, and the intervals computed
+          for an edge at depth d of the walk are stored in row d of
+          scratch. The position p was pruned from is only scored if
+          origin is set.
+         */
+        struct spr_walk {
+            const rectilinear_tree& t;
+            interval_ref pruned;
+            int radius;
+            bool origin;
+            interval_arena& scratch;
+            std::vector<std::pair<int, int>> scores;
+
+            // score of regrafting p onto the edge between below and above
+            void record(int y, const interval_ref& below, const interval_ref& above) {
+                const interval_arena& in = t.intervals;
+                const int* weights = t.patterns->weights.data();
+
+                int score = below.score + above.score + pruned.score;
+                visit_interval_type(in.type(), [&](auto type) {
+                    typedef decltype(type) T;
+                    const kernels::interval_kernels<T>& table = kernels::dispatch().intervals<T>();
+                    for (size_t b = 0; b < in.num_blocks(); b++) {
+                        score += table.triplet_cost(below.arena->start<T>(below.row, b), below.arena->end<T>(below.row, b),
+                                                    pruned.arena->start<T>(pruned.row, b), pruned.arena->end<T>(pruned.row, b),
+                                                    above.arena->start<T>(above.row, b), above.arena->end<T>(above.row, b),
+                                                    nullptr, nullptr,
+                                                    weights + in.block_begin(b), in.block_size(b));
+                    }
+                });
+
+                scores.push_back(std::make_pair(y, score));
+            }
+
+            // merges a and b into row depth of scratch
+            interval_ref merge(const interval_ref& a, const interval_ref& b, int depth) {
+                int cost = merge_rows(t, *a.arena, a.row, *b.arena, b.row, scratch, depth);
+                return {&scratch, depth, a.score + b.score + cost};
             }
 
-            callstack.push(node);
-            for (const auto& child : t.successors(node)) {
-                if (!t[child].data.visited) callstack.push(child);
+            /*
+              Visits the edge above y, where y lies below the pruned
+              position so that its subtree is unchanged, and the edges
+              below it.
+             */
+            void down(int y, const interval_ref& above, int depth) {
+                interval_ref below = {&t.intervals, y, t.tree[y].score};
+                if (depth > 0 || origin) record(y, below, above);
+                if (depth == radius || t.tree.is_leaf(y)) return;
+
+                for (int child : t.tree.children(y)) {
+                    int sibling = t.tree.sibling(child);
+                    down(child, merge(above, {&t.intervals, sibling, t.tree[sibling].score}, depth + 1), depth + 1);
+                }
+            }
+
+            /*
+              Visits the edge (x, y) of the pruned tree, where x is an
+              ancestor of q and below holds the intervals of y in the
+              pruned tree, and the edges reached by going up from it.
+              child is the child of x on the path to q in t.
+             */
+            void up(int x, int y, int child, const interval_ref& below, int depth) {
+                if (depth > 0) record(y, below, {&t.outside, y, t.tree[y].outside_score});
+                if (depth == radius) return;
+
+                int sibling = t.tree.sibling(child);
+                interval_ref sibling_ref = {&t.intervals, sibling, t.tree[sibling].score};
+                if (x == 0) {
+                    down(sibling, below, depth + 1);
+                    return;
+                }
+
+                down(sibling, merge({&t.outside, x, t.tree[x].outside_score}, below, depth + 1), depth + 1);
+                up(t.tree.parent(x), x, x, merge(below, sibling_ref, depth + 1), depth + 1);
+            }
+        };
+    }
+
+    namespace {
+        // resizes scratch to hold rows rows of the same shape as the arenas of t
+        void fit_scratch(const rectilinear_tree& t, size_t rows, interval_arena& scratch) {
+            const interval_arena& in = t.intervals;
+            if (scratch.rows() != rows || scratch.bins() != in.bins() || scratch.layout() != in.layout() ||
+                scratch.type() != in.type()) {
+                size_t block_width = in.num_blocks() == 0 ? 1 : in.block_size(0);
+                scratch = interval_arena(rows, in.bins(), in.layout(), block_width, in.type());
             }
         }
+
+        // regrafts of p, with intervals pruned, walked with the rows of scratch
+        std::vector<std::pair<int, int>> regraft_scores(const rectilinear_tree& t, int p, const interval_ref& pruned,
+                                                        int radius, bool origin, interval_arena& scratch) {
+            int q = t.tree.parent(p);
+            int s = t.tree.sibling(p);
+            spr_walk walk = {t, pruned, radius, origin, scratch, {}};
+
+            // the edge (parent(q), s) of the pruned tree is the position p was pruned from
+            walk.down(s, {&t.outside, q, t.tree[q].outside_score}, 0);
+            walk.up(t.tree.parent(q), s, q, {&t.intervals, s, t.tree[s].score}, 0);
+            return walk.scores;
+        }
+    }
+
+    std::vector<std::pair<int, int>> spr_scores(const rectilinear_tree& t, int p, int radius,
+                                                interval_arena& scratch) {
+        fit_scratch(t, radius + 1, scratch);
+        return regraft_scores(t, p, {&t.intervals, p, t.tree[p].score}, radius, false, scratch);
     }
 
-    void nni(digraph<rectilinear_vertex_data>& t, int u, int w, int v, int z) {
-        t.remove_edge(u, w);
-        t.remove_edge(v, z);
-        t.add_edge(v, w);
-        t.add_edge(u, z);
+    void tbr(rectilinear_tree& t, int p, int r, int y) {
+        if (r != p) t.tree.reroot(p, r);
+        t.tree.prune_regraft(p, y);
+        hash_topology(t);
     }
 
-    void undo_nni(digraph<rectilinear_vertex_data>& t, int u, int w, int v, int z) {
-        t.add_edge(u, w);
-        t.add_edge(v, z);
-        t.remove_edge(v, w);
-        t.remove_edge(u, z);
+    namespace {
+        /*
+          Walks the edges of the subtree p at depth 1 to radius below
+          its root edge, calling visit(r, rerooted) with the intervals
+          of the subtree rerooted at the edge above r. The intervals of
+          the part of the subtree above an edge at depth d are stored
+          in row d of scratch, and the rerooted intervals in row
+          radius + 1.
+         */
+        struct reroot_walk {
+            const rectilinear_tree& t;
+            int radius;
+            interval_arena& scratch;
+            const std::function<void(int, const interval_ref&)>& visit;
+
+            void down(int r, const interval_ref& above, int depth) {
+                if (depth > 0) {
+                    int cost = merge_rows(t, t.intervals, r, *above.arena, above.row, scratch, radius + 1);
+                    visit(r, {&scratch, radius + 1, t.tree[r].score + above.score + cost});
+                }
+
+                if (depth == radius || t.tree.is_leaf(r)) return;
+
+                for (int child : t.tree.children(r)) {
+                    int sibling = t.tree.sibling(child);
+                    int cost = merge_rows(t, *above.arena, above.row, t.intervals, sibling, scratch, depth + 1);
+                    down(child, {&scratch, depth + 1, above.score + t.tree[sibling].score + cost}, depth + 1);
+                }
+            }
+        };
+
+        /*
+          Returns the scores of the TBR moves bisecting t at the edge
+          above p, as (r, y, score) tuples in a fixed order: the
+          subtree p is rerooted at the edge above r, at most radius
+          edges from its root edge (r = p keeps the root), and
+          reconnected onto the edge above y, at most radius edges from
+          where it was pruned.
+         */
+        std::vector<std::tuple<int, int, int>> tbr_scores(const rectilinear_tree& t, int p, int radius,
+                                                          interval_arena& regraft_scratch,
+                                                          interval_arena& reroot_scratch) {
+            fit_scratch(t, radius + 1, regraft_scratch);
+            fit_scratch(t, radius + 2, reroot_scratch);
+
+            std::vector<std::tuple<int, int, int>> scores;
+            auto reconnect = [&](int r, const interval_ref& rerooted) {
+                for (auto [y, score] : regraft_scores(t, p, rerooted, radius, r != p, regraft_scratch)) {
+                    scores.push_back(std::make_tuple(r, y, score));
+                }
+            };
+
+            reconnect(p, {&t.intervals, p, t.tree[p].score});
+            if (t.tree.is_leaf(p)) return scores;
+
+            // both children of p lie below the root edge of the subtree
+            std::function<void(int, const interval_ref&)> visit = reconnect;
+            reroot_walk walk = {t, radius, reroot_scratch, visit};
+            for (int child : t.tree.children(p)) {
+                int sibling = t.tree.sibling(child);
+                walk.down(child, {&t.intervals, sibling, t.tree[sibling].score}, 0);
+            }
+
+            return scores;
+        }
     }
 
-    void unvisit(digraph<rectilinear_vertex_data> &t, int root, int u) {
+    void unvisit(rectilinear_tree &t, int root, int u) {
         int current_node = u;
         do {
-            t[current_node].data.visited = false;
-            current_node = *t.predecessors(current_node).begin(); // requires only one parent exists, i.e. t is a tree
+            t.tree[current_node].visited = false;
+            current_node = t.tree.parent(current_node);
         } while (current_node != root);
     }
 
-    void unvisit(digraph<rectilinear_vertex_data> &t, int root) {
+    void unvisit(rectilinear_tree &t, int root) {
         std::stack<int> callstack;
         callstack.push(root);
         while (!callstack.empty()) {
             int node = callstack.top();
             callstack.pop();
 
-            t[node].data.visited = false;
-            for (const auto& child : t.successors(node)) {
+            t.tree[node].visited = false;
+            if (t.tree.is_leaf(node)) continue;
+            for (int child : t.tree.children(node)) {
                 callstack.push(child);
             }
         }
     }
 
+    namespace {
+        // the NNI neighborhood of t in the exploration order given by edges
+        std::vector<std::tuple<int, int, int, int>> nni_moves(const rectilinear_tree &t, const std::vector<int> &edges) {
+            std::vector<std::tuple<int, int, int, int>> moves;
+            for (int v : edges) {
+                if (t.tree.is_leaf(v)) continue;
+
+                int u = t.tree.parent(v);
+                int w = t.tree.sibling(v);
+                for (int z : t.tree.children(v)) {
+                    moves.push_back(std::make_tuple(u, w, v, z));
+                }
+            }
+
+            return moves;
+        }
+    }
+
     /*
-      Performs all NNIs in the immediate neighborhood of the passed in
+      Scores all NNIs in the immediate neighborhood of the passed in
       tree and returns the best move. Does not modify the input tree.
+      Edges are identified by their child vertex and explored in the
+      order given by edges.
+
+      With more than one thread in the pool, moves are scored in
+      parallel and reduced in exploration order, so the returned move
+      is the one the serial scan would return. In greedy mode moves
+      are scored in windows, stopping at the first window containing
+      an improvement.
       
       Requires:
         - t satisfies the *rectilinear invariant*.
+        - t satisfies the *outside invariant*.
      */
-    std::optional<std::tuple<int, int, int, int>> greedy_nni(digraph<rectilinear_vertex_data> &t, 
-                                                             const std::map<int, std::pair<int, int>> &indexed_edges,
-                                                             const std::vector<int> &edge_indices,
-                                                             bool greedy) {
-        int best_score = t[0].data.score; // i.e. best_score = \infty
+    std::optional<std::tuple<int, int, int, int>> greedy_nni(const rectilinear_tree &t, 
+                                                             const std::vector<int> &edges,
+                                                             const search_options &options) {
+        int best_score = t.tree[0].score; // i.e. best_score = \infty
         std::optional<std::tuple<int, int, int, int>> best_move;
-        for (int idx : edge_indices) {
-            const auto& [u, v] = indexed_edges.at(idx);
 
-            if (t.successors(v).empty()) continue; // i.e if not internal
+        if (options.pool == nullptr || options.pool->size() == 1) {
+            for (int v : edges) {
+                if (t.tree.is_leaf(v)) continue; // i.e if not internal
 
-            std::vector<int> u_children;
-            std::vector<int> v_children;
+                int u = t.tree.parent(v);
+                int w = t.tree.sibling(v);
+                for (int z : t.tree.children(v)) {
+                    int score = nni_score(t, 0, u, w, v, z, best_score);
+                    if (score < best_score) {
+                        best_score = score;
+                        best_move = std::make_tuple(u, w, v, z);
 
-            for (int w : t.successors(u)) {
-                if (w != v) {
-                    u_children.push_back(w);
+                        if (options.greedy) return best_move;
+                    }
                 }
             }
 
-            for (int w : t.successors(v)) {
-                v_children.push_back(w);
+            return best_move;
+        }
+
+        std::vector<std::tuple<int, int, int, int>> moves = nni_moves(t, edges);
+        std::vector<int> scores(moves.size());
+        size_t window = options.greedy ? 16 * options.pool->size() : moves.size();
+        for (size_t begin = 0; begin < moves.size(); begin += window) {
+            size_t end = std::min(moves.size(), begin + window);
+            int ceiling = best_score; // only decreases during the reduction
+            options.pool->parallel_for(end - begin, [&](size_t i, size_t) {
+                auto [u, w, v, z] = moves[begin + i];
+                scores[begin + i] = nni_score(t, 0, u, w, v, z, ceiling);
+            });
+
+            for (size_t i = begin; i < end; i++) {
+                if (scores[i] < best_score) {
+                    best_score = scores[i];
+                    best_move = moves[i];
+
+                    if (options.greedy) return best_move;
+                }
             }
+        }
 
+        return best_move;
+    }
+
+    namespace {
+        // true if t is a topology some earlier climb ended in
+        bool known_optimum(const rectilinear_tree& t, const search_options& options) {
+            return options.cache != nullptr && options.cache->contains(t.topology);
+        }
+    }
 
-            for (auto w : u_children) {
-                for (auto z : v_children) {
-                    nni(t, u, w, v, z);
-                    unvisit(t, 0, v);
-                    small_rectilinear(t, 0);
+    namespace {
+        /*
+          Hill climbs with every neighborhood scored block by block, by
+          summing the scores of each move over all blocks. Moves are
+          then selected exactly as greedy_nni selects them.
+         */
+        rectilinear_tree blocked_hill_climb(rectilinear_tree t, const std::vector<int>& edges,
+                                            const search_options& options) {
+            const pattern_blocks& blocks = *options.blocks;
+            while (true) {
+                std::vector<std::tuple<int, int, int, int>> moves = nni_moves(t, edges);
+                std::vector<int> move_scores(moves.size(), 0);
+                std::vector<int> scores(t.tree.size(), 0);
+
+                for (size_t b = 0; b < blocks.num_blocks(); b++) {
+                    blocks.load(t, b);
+                    small_rectilinear(t, 0, options.bin_pool());
+                    outside_rectilinear(t, 0, options.bin_pool());
+                    for (size_t u = 0; u < t.tree.size(); u++) {
+                        scores[u] += t.tree[u].score;
+                    }
 
-                    int score = t[0].data.score;
-                    if (score < best_score) {
-                        best_score = score;
-                        best_move = std::make_tuple(u, w, v, z);
+                    auto score_move = [&](size_t i, size_t) {
+                        auto [u, w, v, z] = moves[i];
+                        move_scores[i] += nni_score(t, 0, u, w, v, z);
+                    };
 
-                        if (greedy) {
-                            undo_nni(t, u, w, v, z);
-                            unvisit(t, 0, v);
-                            return best_move;
+                    if (options.pool != nullptr) {
+                        options.pool->parallel_for(moves.size(), score_move);
+                    } else {
+                        for (size_t i = 0; i < moves.size(); i++) score_move(i, 0);
+                    }
+                }
+
+                for (size_t u = 0; u < t.tree.size(); u++) {
+                    t.tree[u].score = scores[u];
+                }
+
+                int best_score = t.tree[0].score;
+                std::optional<size_t> best_move;
+                for (size_t i = 0; i < moves.size(); i++) {
+                    if (move_scores[i] < best_score) {
+                        best_score = move_scores[i];
+                        best_move = i;
+
+                        if (options.greedy) break;
+                    }
+                }
+
+                if (!best_move) return t;
+
+                auto [u, w, v, z] = moves[*best_move];
+                nni(t, u, w, v, z);
+
+                if (known_optimum(t, options)) {
+                    small_rectilinear(t, 0, blocks, options.bin_pool());
+                    return t;
+                }
+            }
+        }
+    }
+
+    namespace {
+        // the subtrees that can be pruned, in the exploration order given by edges
+        std::vector<int> spr_prunes(const rectilinear_tree& t, const std::vector<int>& edges) {
+            std::vector<int> prunes;
+            for (int p : edges) {
+                if (t.tree.parent(p) == 0) continue;
+                prunes.push_back(p);
+            }
+
+            return prunes;
+        }
+
+        /*
+          Adds the SPR scores of pruning prunes[begin, end) to scores,
+          on the pool if one is given, where every worker walks the
+          tree with its own scratch arena.
+         */
+        void score_prunes(const rectilinear_tree& t, const std::vector<int>& prunes, size_t begin, size_t end,
+                          const search_options& options, std::vector<interval_arena>& scratch,
+                          std::vector<std::vector<std::pair<int, int>>>& scores) {
+            auto score_prune = [&](size_t i, size_t worker) {
+                std::vector<std::pair<int, int>> prune_scores = spr_scores(t, prunes[begin + i], options.spr_radius,
+                                                                           scratch[worker]);
+                std::vector<std::pair<int, int>>& total = scores[begin + i];
+                if (total.empty()) {
+                    total = std::move(prune_scores);
+                    return;
+                }
+
+                for (size_t k = 0; k < total.size(); k++) {
+                    total[k].second += prune_scores[k].second;
+                }
+            };
+
+            if (options.pool != nullptr) {
+                options.pool->parallel_for(end - begin, score_prune);
+            } else {
+                for (size_t i = begin; i < end; i++) score_prune(i - begin, 0);
+            }
+        }
+
+        /*
+          Hill climbs over SPR neighborhoods. Every iteration prunes
+          each subtree in the exploration order given by edges and
+          scores its regrafts from the cached inside and outside
+          intervals, applying the best (or, if greedy, the first)
+          improving move. Only the two paths from the old and new
+          positions of the pruned subtree to the root are rescored.
+
+          Moves are selected in exploration order, so the trajectory
+          does not depend on the number of threads. Block by block,
+          the neighborhood scores are summed over all blocks before
+          selecting a move.
+         */
+        rectilinear_tree spr_hill_climb(rectilinear_tree t, const std::vector<int>& edges,
+                                        const search_options& options) {
+            size_t num_workers = options.pool == nullptr ? 1 : options.pool->size();
+            size_t window = options.greedy ? 16 * num_workers : edges.size();
+            std::vector<interval_arena> scratch(num_workers);
+
+            int current_score = t.tree[0].score;
+            while (true) {
+                std::vector<int> prunes = spr_prunes(t, edges);
+                std::vector<std::vector<std::pair<int, int>>> scores(prunes.size());
+
+                if (options.blocks != nullptr) {
+                    const pattern_blocks& blocks = *options.blocks;
+                    std::vector<int> vertex_scores(t.tree.size(), 0);
+                    for (size_t b = 0; b < blocks.num_blocks(); b++) {
+                        blocks.load(t, b);
+                        small_rectilinear(t, 0, options.bin_pool());
+                        outside_rectilinear(t, 0, options.bin_pool());
+                        for (size_t u = 0; u < t.tree.size(); u++) {
+                            vertex_scores[u] += t.tree[u].score;
                         }
+
+                        score_prunes(t, prunes, 0, prunes.size(), options, scratch, scores);
+                    }
+
+                    for (size_t u = 0; u < t.tree.size(); u++) {
+                        t.tree[u].score = vertex_scores[u];
                     }
+                } else {
+                    outside_rectilinear(t, 0, options.bin_pool());
+                }
+
+                int best_score = t.tree[0].score;
+                std::optional<std::pair<int, int>> best_move;
+                for (size_t begin = 0; begin < prunes.size() && !(options.greedy && best_move); begin += window) {
+                    size_t end = std::min(prunes.size(), begin + window);
+                    if (options.blocks == nullptr) {
+                        score_prunes(t, prunes, begin, end, options, scratch, scores);
+                    }
+
+                    for (size_t i = begin; i < end && !(options.greedy && best_move); i++) {
+                        for (auto [y, score] : scores[i]) {
+                            if (score < best_score) {
+                                best_score = score;
+                                best_move = std::make_pair(prunes[i], y);
+
+                                if (options.greedy) break;
+                            }
+                        }
+                    }
+                }
 
-                    undo_nni(t, u, w, v, z);
-                    unvisit(t, 0, v);
+                if (!best_move) return t;
 
+                auto [p, y] = *best_move;
+                int g = t.tree.parent(t.tree.parent(p));
+                spr(t, p, y);
+
+                // block by block, the next iteration rescores the whole tree
+                if (options.blocks != nullptr) {
+                    if (known_optimum(t, options)) {
+                        small_rectilinear(t, 0, *options.blocks, options.bin_pool());
+                        return t;
+                    }
+
+                    continue;
                 }
+
+                if (g != 0) unvisit(t, 0, g);
+                unvisit(t, 0, t.tree.parent(p));
+                small_rectilinear(t, 0, options.bin_pool());
+
+                int new_score = t.tree[0].score;
+                if (current_score <= new_score || known_optimum(t, options)) return t;
+                current_score = new_score;
             }
         }
+    }
 
-        return best_move;
+    namespace {
+        /*
+          Cached gain of the NNI on edges (u, w) and (v, z), where u and
+          w are the parent and sibling of v. Moves are ordered by gain
+          and then by exploration order. An entry is stale once the
+          moves on the edge above v have been re-evaluated.
+         */
+        struct queued_move {
+            int gain;
+            size_t order;
+            int v;
+            int z;
+            unsigned version;
+
+            bool operator<(const queued_move& other) const {
+                if (gain != other.gain) return gain < other.gain;
+                return order > other.order;
+            }
+        };
+
+        /*
+          Hill climbs over NNIs with a priority queue of move gains.
+          The best queued move is re-scored before it is applied, and
+          applying it only re-evaluates the moves on the edges along
+          its path to the root, on their siblings and below v, leaving
+          the cached gains elsewhere untouched. The outside intervals
+          a move is scored with are brought up to date lazily, from
+          their nearest up to date ancestor.
+
+          Once the queue runs dry the whole neighborhood is rescored,
+          so the climb ends in the same kind of local optimum as
+          hill_climb.
+         */
+        struct move_queue_climb {
+            rectilinear_tree& t;
+            const std::vector<int>& edges;
+            const search_options& options;
+
+            std::vector<size_t> order;          // of the edge above each vertex in edges
+            std::vector<unsigned> version;      // of the queued moves on the edge above each vertex
+            std::vector<unsigned> outside_epoch;
+            unsigned epoch = 0;                 // outside intervals of an older epoch are out of date
+            std::priority_queue<queued_move> queue;
+
+            move_queue_climb(rectilinear_tree& t, const std::vector<int>& edges, const search_options& options) :
+                t(t), edges(edges), options(options),
+                order(t.tree.size(), 0), version(t.tree.size(), 0), outside_epoch(t.tree.size(), 0) {
+                for (size_t i = 0; i < edges.size(); i++) {
+                    order[edges[i]] = i;
+                }
+            }
+
+            void refresh_outside(int y) {
+                std::vector<int> path;
+                for (int x = y; x != 0 && outside_epoch[x] != epoch; x = t.tree.parent(x)) {
+                    path.push_back(x);
+                }
+
+                for (auto it = path.rbegin(); it != path.rend(); ++it) {
+                    int child = *it;
+                    int node = t.tree.parent(child);
+                    int sibling = t.tree.sibling(child);
+                    if (node == 0) {
+                        t.outside.copy_row(child, t.intervals, sibling);
+                        t.tree[child].outside_score = t.tree[sibling].score;
+                    } else {
+                        int cost = merge_rows(t, t.outside, node, t.intervals, sibling, t.outside, child);
+                        t.tree[child].outside_score = cost + t.tree[node].outside_score + t.tree[sibling].score;
+                    }
+
+                    outside_epoch[child] = epoch;
+                }
+            }
+
+            int score(int v, int z) {
+                int u = t.tree.parent(v);
+                if (u != 0) refresh_outside(u);
+                return nni_score(t, 0, u, t.tree.sibling(v), v, z);
+            }
+
+            void push(int v, int z, int score) {
+                int gain = t.tree[0].score - score;
+                if (gain > 0) queue.push({gain, order[v], v, z, version[v]});
+            }
+
+            // re-evaluates the moves on the edge above v, making its queued moves stale
+            void evaluate(int v) {
+                version[v]++;
+                if (v == 0 || t.tree.is_leaf(v)) return;
+
+                for (int z : t.tree.children(v)) {
+                    push(v, z, score(v, z));
+                }
+            }
+
+            void scan() {
+                outside_rectilinear(t, 0, options.bin_pool());
+                epoch++;
+                std::fill(outside_epoch.begin(), outside_epoch.end(), epoch);
+                queue = std::priority_queue<queued_move>();
+
+                std::vector<std::tuple<int, int, int, int>> moves = nni_moves(t, edges);
+                std::vector<int> scores(moves.size());
+                auto score_move = [&](size_t i, size_t) {
+                    auto [u, w, v, z] = moves[i];
+                    scores[i] = nni_score(t, 0, u, w, v, z);
+                };
+
+                if (options.pool != nullptr) {
+                    options.pool->parallel_for(moves.size(), score_move);
+                } else {
+                    for (size_t i = 0; i < moves.size(); i++) score_move(i, 0);
+                }
+
+                for (int v : edges) version[v]++;
+                for (size_t i = 0; i < moves.size(); i++) {
+                    push(std::get<2>(moves[i]), std::get<3>(moves[i]), scores[i]);
+                }
+            }
+
+            void apply(int v, int z) {
+                int u = t.tree.parent(v);
+                int w = t.tree.sibling(v);
+
+                nni(t, u, w, v, z);
+                rescore_nni(t, 0, u, v);
+
+                // the NNI only rearranges the subtree u, so the outside of u and its ancestors is kept
+                epoch++;
+                for (int a = u; a != 0; a = t.tree.parent(a)) {
+                    if (outside_epoch[a] + 1 == epoch) outside_epoch[a] = epoch;
+                }
+
+                std::vector<int> affected;
+                for (int a = v; a != 0; a = t.tree.parent(a)) {
+                    affected.push_back(a);
+                    affected.push_back(t.tree.sibling(a));
+                }
+
+                for (int c : t.tree.children(v)) {
+                    affected.push_back(c);
+                }
+
+                std::sort(affected.begin(), affected.end());
+                affected.erase(std::unique(affected.begin(), affected.end()), affected.end());
+                for (int a : affected) {
+                    evaluate(a);
+                }
+            }
+
+            // applies the best queued move that still improves t, if any
+            bool step() {
+                while (!queue.empty()) {
+                    queued_move top = queue.top();
+                    queue.pop();
+                    if (top.version != version[top.v]) continue;
+
+                    top.gain = t.tree[0].score - score(top.v, top.z);
+                    if (top.gain <= 0) continue;
+
+                    while (!queue.empty() && queue.top().version != version[queue.top().v]) {
+                        queue.pop();
+                    }
+
+                    if (!queue.empty() && top < queue.top()) {
+                        queue.push(top);
+                        continue;
+                    }
+
+                    apply(top.v, top.z);
+                    return true;
+                }
+
+                return false;
+            }
+
+            void run() {
+                while (true) {
+                    scan();
+                    if (!step()) return;
+
+                    do {
+                        if (known_optimum(t, options)) return;
+                    } while (step());
+                }
+            }
+        };
     }
 
-    digraph<rectilinear_vertex_data> hill_climb(digraph<rectilinear_vertex_data> t, std::ranlux48_base& gen, bool greedy) {
-        std::map<int, std::pair<int, int>> index_to_edges;
-        std::map<std::pair<int, int>, int> edges_to_index;
-        std::vector<int> random_indices;
-        
-        int idx = 0;
-        for (const auto &p : t.edges()) {
-            index_to_edges[idx] = p;
-            edges_to_index[p] = idx;
-            random_indices.push_back(idx);
-            idx++;
+    namespace {
+        /*
+          Hill climbs by applying batches of NNIs. Every iteration scores
+          the whole neighborhood and greedily picks, from best to worst,
+          improving moves that share no vertex with a move already
+          picked. The batch is applied and the tree rescored at once,
+          and if the combined score does not beat the best single move,
+          the batch is undone and only the best move applied.
+         */
+        rectilinear_tree batch_hill_climb(rectilinear_tree t, const std::vector<int>& edges,
+                                          const search_options& options) {
+            int current_score = t.tree[0].score;
+            while (true) {
+                outside_rectilinear(t, 0, options.bin_pool());
+
+                std::vector<std::tuple<int, int, int, int>> moves = nni_moves(t, edges);
+                std::vector<int> scores(moves.size());
+                auto score_move = [&](size_t i, size_t) {
+                    auto [u, w, v, z] = moves[i];
+                    scores[i] = nni_score(t, 0, u, w, v, z, current_score);
+                };
+
+                if (options.pool != nullptr) {
+                    options.pool->parallel_for(moves.size(), score_move);
+                } else {
+                    for (size_t i = 0; i < moves.size(); i++) score_move(i, 0);
+                }
+
+                std::vector<size_t> improving;
+                for (size_t i = 0; i < moves.size(); i++) {
+                    if (scores[i] < current_score) improving.push_back(i);
+                }
+
+                if (improving.empty()) return t;
+
+                std::stable_sort(improving.begin(), improving.end(), [&](size_t a, size_t b) {
+                    return scores[a] < scores[b];
+                });
+
+                std::vector<bool> used(t.tree.size(), false);
+                std::vector<std::tuple<int, int, int, int>> batch;
+                for (size_t i : improving) {
+                    auto [u, w, v, z] = moves[i];
+                    if (used[u] || used[w] || used[v] || used[z]) continue;
+
+                    used[u] = used[w] = used[v] = used[z] = true;
+                    batch.push_back(moves[i]);
+                }
+
+                int best_score = scores[improving[0]];
+                if (batch.size() > 1) {
+                    for (auto [u, w, v, z] : batch) nni(t, u, w, v, z);
+                    for (auto [u, w, v, z] : batch) unvisit(t, 0, v);
+                    small_rectilinear(t, 0, options.bin_pool());
+
+                    if (t.tree[0].score < best_score) {
+                        current_score = t.tree[0].score;
+                        if (known_optimum(t, options)) return t;
+                        continue;
+                    }
+
+                    for (auto it = batch.rbegin(); it != batch.rend(); ++it) {
+                        auto [u, w, v, z] = *it;
+                        undo_nni(t, u, w, v, z);
+                    }
+
+                    for (auto [u, w, v, z] : batch) unvisit(t, 0, v);
+                    small_rectilinear(t, 0, options.bin_pool());
+                }
+
+                auto [u, w, v, z] = batch[0];
+                nni(t, u, w, v, z);
+                rescore_nni(t, 0, u, v);
+
+                int new_score = t.tree[0].score;
+                if (current_score <= new_score || known_optimum(t, options)) return t;
+                current_score = new_score;
+            }
+        }
+    }
+
+    namespace {
+        // climbs from t with the strategy selected by options
+        rectilinear_tree climb(rectilinear_tree t, const std::vector<int>& random_edges, const search_options& options) {
+            if (known_optimum(t, options)) return t;
+
+            if (options.moves == move_set::spr) {
+                return spr_hill_climb(std::move(t), random_edges, options);
+            }
+
+            if (options.blocks != nullptr) {
+                return blocked_hill_climb(std::move(t), random_edges, options);
+            }
+
+            if (options.move_queue) {
+                move_queue_climb(t, random_edges, options).run();
+                return t;
+            }
+
+            if (options.batch) {
+                return batch_hill_climb(std::move(t), random_edges, options);
+            }
+
+            int current_score = t.tree[0].score;
+            int iterations = 0;
+            for (; true; iterations++) {
+                outside_rectilinear(t, 0, options.bin_pool());
+                auto best_move = greedy_nni(t, random_edges, options);
+                if (!best_move) break;
+
+                auto [u, w, v, z] = *best_move;
+                nni(t, u, w, v, z);
+
+                rescore_nni(t, 0, u, v);
+                int new_score = t.tree[0].score;
+
+                if (current_score <= new_score || known_optimum(t, options)) break;
+                current_score = new_score;
+            }
+
+            return t;
+        }
+    }
+
+    rectilinear_tree hill_climb(rectilinear_tree t, std::ranlux48_base& gen, const search_options& options) {
+        // an NNI on (u, w) and (v, z) re-attaches the edges above w
+        // and z, so identifying edges by their child keeps the
+        // random exploration order stable across moves
+        std::vector<int> random_edges;
+        for (auto [u, v] : t.tree.edges()) {
+            random_edges.push_back(v);
         }
             
-        std::shuffle(random_indices.begin(), random_indices.end(), gen);
+        std::shuffle(random_edges.begin(), random_edges.end(), gen);
+
+        rectilinear_tree result = climb(std::move(t), random_edges, options);
+        if (options.cache != nullptr) {
+            options.cache->insert(result.topology);
+        }
+
+        return result;
+    }
+
+    rectilinear_tree tbr_polish(rectilinear_tree t, const search_options& options, int radius, double seconds) {
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::duration<double>(seconds);
+        size_t num_workers = options.pool == nullptr ? 1 : options.pool->size();
+        std::vector<interval_arena> regraft_scratch(num_workers), reroot_scratch(num_workers);
+
+        std::vector<int> edges;
+        for (size_t v = 1; v < t.tree.size(); v++) {
+            edges.push_back(v);
+        }
+
+        int current_score = t.tree[0].score;
+        while (std::chrono::steady_clock::now() < deadline) {
+            std::vector<int> bisections = spr_prunes(t, edges);
+            std::vector<std::vector<std::tuple<int, int, int>>> scores(bisections.size());
+
+            // in memory, bisections are skipped once the deadline passed
+            auto score_bisection = [&](size_t i, size_t worker) {
+                if (options.blocks == nullptr && std::chrono::steady_clock::now() >= deadline) return;
+
+                auto bisection_scores = tbr_scores(t, bisections[i], radius,
+                                                   regraft_scratch[worker], reroot_scratch[worker]);
+                if (scores[i].empty()) {
+                    scores[i] = std::move(bisection_scores);
+                    return;
+                }
+
+                for (size_t k = 0; k < scores[i].size(); k++) {
+                    std::get<2>(scores[i][k]) += std::get<2>(bisection_scores[k]);
+                }
+            };
+
+            auto score_bisections = [&]() {
+                if (options.pool != nullptr) {
+                    options.pool->parallel_for(bisections.size(), score_bisection);
+                } else {
+                    for (size_t i = 0; i < bisections.size(); i++) score_bisection(i, 0);
+                }
+            };
+
+            if (options.blocks != nullptr) {
+                const pattern_blocks& blocks = *options.blocks;
+                std::vector<int> vertex_scores(t.tree.size(), 0);
+                for (size_t b = 0; b < blocks.num_blocks(); b++) {
+                    blocks.load(t, b);
+                    small_rectilinear(t, 0, options.bin_pool());
+                    outside_rectilinear(t, 0, options.bin_pool());
+                    for (size_t u = 0; u < t.tree.size(); u++) {
+                        vertex_scores[u] += t.tree[u].score;
+                    }
+
+                    score_bisections();
+                }
+
+                for (size_t u = 0; u < t.tree.size(); u++) {
+                    t.tree[u].score = vertex_scores[u];
+                }
+            } else {
+                outside_rectilinear(t, 0, options.bin_pool());
+                score_bisections();
+            }
+
+            int best_score = t.tree[0].score;
+            std::optional<std::tuple<int, int, int>> best_move;
+            for (size_t i = 0; i < bisections.size(); i++) {
+                for (auto [r, y, score] : scores[i]) {
+                    if (score < best_score) {
+                        best_score = score;
+                        best_move = std::make_tuple(bisections[i], r, y);
+                    }
+                }
+            }
 
-        int current_score = t[0].data.score;
-        int iterations = 0;
-        for (; true; iterations++) {
-            auto best_move = greedy_nni(t, index_to_edges, random_indices, greedy);
             if (!best_move) break;
 
-            auto [u, w, v, z] = *best_move;
-            nni(t, u, w, v, z);
+            auto [p, r, y] = *best_move;
+            int g = t.tree.parent(t.tree.parent(p));
 
-            // update edge map by deleting (u, w) and (v, z) and adding
-            // (v, w) and (u, z)
-            int i1 = edges_to_index[std::make_pair(u, w)];
-            int i2 = edges_to_index[std::make_pair(v, z)];
-            index_to_edges[i1] = std::make_pair(v, w);
-            edges_to_index[std::make_pair(v, w)] = i1;
-            index_to_edges[i2] = std::make_pair(u, z);
-            edges_to_index[std::make_pair(u, z)] = i2;
+            // the child of p on the path to r is the deepest vertex the reroot changes
+            int rerooted = r;
+            while (r != p && t.tree.parent(rerooted) != p) rerooted = t.tree.parent(rerooted);
 
-            unvisit(t, 0, v);
-            small_rectilinear(t, 0);
-            int new_score = t[0].data.score;
+            tbr(t, p, r, y);
+            if (options.blocks != nullptr) continue;
 
+            if (g != 0) unvisit(t, 0, g);
+            if (r != p) unvisit(t, 0, rerooted);
+            unvisit(t, 0, t.tree.parent(p));
+            small_rectilinear(t, 0, options.bin_pool());
+
+            int new_score = t.tree[0].score;
             if (current_score <= new_score) break;
             current_score = new_score;
         }
 
+        if (options.blocks != nullptr) score_tree(t, options);
         return t;
     }
 
-    digraph<rectilinear_vertex_data> stochastic_nni(const digraph<rectilinear_vertex_data>& t, std::ranlux48_base& gen, float aggression) {
-        digraph<rectilinear_vertex_data> perturbed_t = t;
+    void score_tree(rectilinear_tree& t, const search_options& options) {
+        if (options.blocks != nullptr) {
+            small_rectilinear(t, 0, *options.blocks, options.bin_pool());
+        } else {
+            small_rectilinear(t, 0, options.bin_pool());
+        }
+    }
+
+    rectilinear_tree stochastic_nni(const rectilinear_tree& t, std::ranlux48_base& gen, float aggression) {
+        rectilinear_tree perturbed_t = t;
 
         // TODO: investigate performance gain from
         // not recomputing internal edges at every iteration
         std::vector<std::pair<int, int>> internal_edges;
-        for (auto [u, v] : perturbed_t.edges()) {
-            if (perturbed_t.successors(v).empty()) continue;
+        for (auto [u, v] : perturbed_t.tree.edges()) {
+            if (perturbed_t.tree.is_leaf(v)) continue;
             internal_edges.push_back(std::make_pair(u, v));
         }
 
         int num_perturbations = internal_edges.size() * aggression;
         for (int i = 0; i < num_perturbations; i++) {
             internal_edges.clear();
-            for (auto [u, v] : perturbed_t.edges()) {
-                if (perturbed_t.successors(v).empty()) continue;
+            for (auto [u, v] : perturbed_t.tree.edges()) {
+                if (perturbed_t.tree.is_leaf(v)) continue;
                 internal_edges.push_back(std::make_pair(u, v));
             }
 
             int index = rand_int(gen, 0, internal_edges.size() - 1);
             auto [u, v] = internal_edges[index];
 
-            std::vector<int> u_children;
-            std::vector<int> v_children;
-
-            for (int w : perturbed_t.successors(u)) {
-                if (w != v) {
-                    u_children.push_back(w);
-                }
-            }
-
-            for (int w : perturbed_t.successors(v)) {
-                v_children.push_back(w);
-            }
+            std::array<int, 1> u_children = {perturbed_t.tree.sibling(v)};
+            std::array<int, 2> v_children = perturbed_t.tree.children(v);
 
             int w = u_children[rand_int(gen, 0, u_children.size() - 1)];
             int z = v_children[rand_int(gen, 0, v_children.size() - 1)];
@@ -460,4 +1771,4 @@ namespace copynumber {
         unvisit(perturbed_t, 0);
         return perturbed_t;
     }
-};
+};
\ No newline at end of file
@@ -0,0 +1,143 @@
+#include "distance_matrix.hpp"
+#include "sankoff_kernels.hpp"
+
+#include <algorithm>
+
+namespace copynumber {
+    namespace {
+        // a tile of 16 rows over 8KB of each row is 128KB, so the
+        // pair of tiles swept together fits into L2
+        constexpr size_t tile_rows = 16;
+        constexpr size_t tile_bytes = 8192;
+
+        /*
+          Rows of a breakpoint matrix in (possibly narrower) storage of
+          type T, each padded with zeros to a multiple of a cache line.
+         */
+        template <typename T>
+        struct row_storage {
+            size_t rows = 0;
+            size_t bins = 0;
+            size_t stride = 0;
+            std::vector<T> data;
+            const T* base = nullptr;
+
+            const T* row(size_t i) const {
+                return base + i * stride;
+            }
+        };
+
+        // views the matrix as is
+        row_storage<int> int_rows(const breakpoint_matrix& m) {
+            row_storage<int> rows;
+            rows.rows = m.rows();
+            rows.bins = m.bins();
+            rows.stride = m.stride();
+            rows.base = m.data();
+            return rows;
+        }
+
+        // copies the matrix, whose values must fit into T
+        template <typename T>
+        row_storage<T> narrow_rows(const breakpoint_matrix& m, thread_pool* pool) {
+            constexpr size_t elems_per_line = 64 / sizeof(T);
+
+            row_storage<T> rows;
+            rows.rows = m.rows();
+            rows.bins = m.bins();
+            rows.stride = (m.bins() + elems_per_line - 1) / elems_per_line * elems_per_line;
+            rows.data.assign(rows.rows * rows.stride, 0);
+            rows.base = rows.data.data();
+
+            auto copy_row = [&](size_t i, size_t) {
+                std::copy(m.row(i), m.row(i) + m.bins(), rows.data.begin() + i * rows.stride);
+            };
+
+            if (pool != nullptr) {
+                pool->parallel_for(rows.rows, copy_row);
+            } else {
+                for (size_t i = 0; i < rows.rows; i++) copy_row(i, 0);
+            }
+
+            return rows;
+        }
+
+        /*
+          Accumulates the distances between the rows of tiles a and b
+          (b >= a) and stores them into d. On the diagonal, only pairs
+          with i < j are computed.
+         */
+        template <typename T>
+        void distance_tile(const row_storage<T>& m, int (*l1_distance)(const T*, const T*, size_t),
+                           size_t a, size_t b, distance_matrix& d) {
+            constexpr size_t tile_bins = tile_bytes / sizeof(T);
+
+            size_t a_begin = a * tile_rows, a_end = std::min(m.rows, a_begin + tile_rows);
+            size_t b_begin = b * tile_rows, b_end = std::min(m.rows, b_begin + tile_rows);
+
+            int distances[tile_rows][tile_rows] = {};
+            for (size_t k = 0; k < m.bins; k += tile_bins) {
+                size_t n = std::min(tile_bins, m.bins - k);
+                for (size_t i = a_begin; i < a_end; i++) {
+                    const T* x = m.row(i) + k;
+                    for (size_t j = std::max(b_begin, i + 1); j < b_end; j++) {
+                        distances[i - a_begin][j - b_begin] += l1_distance(x, m.row(j) + k, n);
+                    }
+                }
+            }
+
+            for (size_t i = a_begin; i < a_end; i++) {
+                for (size_t j = std::max(b_begin, i + 1); j < b_end; j++) {
+                    d(i, j) = distances[i - a_begin][j - b_begin];
+                }
+            }
+        }
+
+        template <typename T>
+        distance_matrix tiled_distances(const row_storage<T>& m, int (*l1_distance)(const T*, const T*, size_t),
+                                        thread_pool* pool) {
+            distance_matrix d(m.rows);
+
+            size_t num_tiles = (m.rows + tile_rows - 1) / tile_rows;
+            std::vector<std::pair<size_t, size_t>> tiles;
+            for (size_t a = 0; a < num_tiles; a++) {
+                for (size_t b = a; b < num_tiles; b++) {
+                    tiles.push_back(std::make_pair(a, b));
+                }
+            }
+
+            // tiles write disjoint entries of d
+            auto compute_tile = [&](size_t t, size_t) {
+                distance_tile(m, l1_distance, tiles[t].first, tiles[t].second, d);
+            };
+
+            if (pool != nullptr) {
+                pool->parallel_for(tiles.size(), compute_tile);
+            } else {
+                for (size_t t = 0; t < tiles.size(); t++) compute_tile(t, 0);
+            }
+
+            return d;
+        }
+    };
+
+    distance_matrix l1_distance_matrix(const breakpoint_matrix& m, thread_pool* pool) {
+        const kernels::kernel_table& kernels = kernels::dispatch();
+
+        // the padding is zero, so it never widens the range
+        const int* begin = m.data();
+        const int* end = m.data() + m.rows() * m.stride();
+        int lo = begin == end ? 0 : *std::min_element(begin, end);
+        int hi = begin == end ? 0 : *std::max_element(begin, end);
+
+        if (lo >= -128 && hi <= 127) {
+            return tiled_distances(narrow_rows<signed char>(m, pool), kernels.l1_distance_i8, pool);
+        }
+
+        if (lo >= -16384 && hi <= 16383) {
+            return tiled_distances(narrow_rows<short>(m, pool), kernels.l1_distance_i16, pool);
+        }
+
+        return tiled_distances(int_rows(m), kernels.l1_distance, pool);
+    }
+};
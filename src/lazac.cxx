@@ -3,7 +3,6 @@
 #include <spdlog/spdlog.h>
 #include <spdlog/sinks/stdout_color_sinks.h>
 #include <argparse/argparse.hpp>
-#include <csv.hpp>
 
 #include <random>
 #include <fstream>
@@ -15,10 +14,18 @@
 #include <optional>
 #include <stack>
 #include <tuple>
+#include <mutex>
+#include <functional>
 
+#include "binary_tree.hpp"
 #include "copy_number.hpp"
 #include "digraph.hpp"
+#include "distance_matrix.hpp"
+#include "sankoff_kernels.hpp"
+#include "thread_pool.hpp"
 #include "lazac.hpp"
+#include "neighbor_joining.hpp"
+#include "profile_io.hpp"
 #include "tree_io.hpp"
 
 #include "dist.h"
@@ -35,74 +42,64 @@ using namespace copynumber;
 using json = nlohmann::json;
 
 /*
-  Reads copy number profiles from a CSV
-  file representation of the profiles.
+  Loads the breakpoint profiles of all cells, either from a binary
+  profile cache written by `lazac convert` or by converting the copy
+  number profiles of a CSV file.
 */
-std::map<std::string, copynumber_profile> read_cn_profiles(std::string cn_profile_file) {
-    std::map<std::string, copynumber_profile> cn_profiles;
-    csv::CSVReader reader(cn_profile_file);
-    for (const csv::CSVRow &row: reader) {
-        std::string node = row["node"].get<std::string>();
-        std::string chrom = row["chrom"].get<std::string>();
-        int start = row["start"].get<int>();
-        int end = row["end"].get<int>();
-        int cn_a = row["cn_a"].get<int>();
-
-        genomic_bin bin(chrom, "cn_a", start, end);
-        if (!cn_profiles.count(node)) {
-            cn_profiles[node] = copynumber_profile();
-        }
-
-        cn_profiles[node].profile.push_back(cn_a);
-        cn_profiles[node].bins.push_back(bin);
+breakpoint_matrix load_breakpoint_profiles(std::string cn_profile_file, thread_pool& pool) {
+    if (is_profile_cache(cn_profile_file)) {
+        breakpoint_matrix profiles = read_profile_cache(cn_profile_file);
+        spdlog::info("Read breakpoint profiles of {} cells over {} bins from cache.", profiles.rows(), profiles.bins());
+        return profiles;
     }
 
-    return cn_profiles;
+    copynumber_matrix m = read_copynumber_matrix(cn_profile_file, &pool);
+    spdlog::info("Read copy number profiles of {} cells over {} bins.", m.cells.size(), m.bins.size());
+
+    return convert_to_breakpoint_matrix(m, 2, &pool);
 }
 
-std::pair<std::vector<string>, std::vector<std::vector<int>>> build_distance_matrix(std::map<std::string, breakpoint_profile> bp_profiles) {
-    std::vector<std::string> names; 
-    for (const auto& [name, _] : bp_profiles) {
-        names.push_back(name);
-    }
+/*
+  Computes the pairwise breakpoint distances between all cells,
+  returning the cell names along with the matrix in the same order.
+*/
+std::pair<std::vector<string>, distance_matrix> build_distance_matrix(const breakpoint_matrix& profiles, thread_pool& pool) {
+    spdlog::info("Building {} x {} distance matrix over {} bins.", profiles.rows(), profiles.rows(), profiles.bins());
 
-    std::sort(names.begin(), names.end());
+    distance_matrix distances = l1_distance_matrix(profiles, &pool);
 
-    // we use a simple representation of a matrix
-    // since it is only used for this purpose
-    // and resize space for the elements
-    std::vector<std::vector<int>> distance_matrix;
-    distance_matrix.resize(names.size());
-    for (std::vector<int>::size_type i = 0; i < names.size(); i++) {
-        distance_matrix[i].resize(names.size());
-    }
+    spdlog::info("Finished building {} x {} distance matrix.", profiles.rows(), profiles.rows());
+    return std::make_pair(profiles.names(), std::move(distances));
+}
 
-    // fill in the elements of the matrix
+/*
+  Writes a distance matrix in the square text format
+  read by Clearcut, i.e. the number of cells followed
+  by one line of space separated distances per cell.
+*/
+void write_distance_matrix(const std::string& filename, const std::vector<std::string>& names,
+                           const distance_matrix& distances) {
+    std::ofstream matrix_output(filename, std::ios::out);
+    matrix_output << names.size() << std::endl;
     for (std::vector<int>::size_type i = 0; i < names.size(); i++) {
-        if (i % 100 == 0) {
-            spdlog::info("Built {} out of {} rows of distance matrix.", i, names.size());
-        }
-
-        for (std::vector<int>::size_type j = i; j < names.size(); j++) {
-            int dist = breakpoint_magnitude(bp_profiles[names[i]] - bp_profiles[names[j]]);
-            distance_matrix[i][j] = dist;
-            distance_matrix[j][i] = dist;
+        matrix_output << names[i];
+        for (std::vector<int>::size_type j = 0; j < names.size(); j++) {
+            matrix_output << " " << distances(i, j);
         }
+        matrix_output << std::endl;
     }
-
-    spdlog::info("Finished building {} x {} distance matrix.", names.size(), names.size());
-    return std::make_tuple(names, distance_matrix);
 }
 
 void do_distance(argparse::ArgumentParser distance) {
-    std::map<std::string, copynumber_profile> cn_profiles = read_cn_profiles(distance.get<std::string>("cn_profile"));
-    std::map<std::string, breakpoint_profile> bp_profiles;
-    for (const auto &[name, cn_profile] : cn_profiles) {
-        auto bp_profile = convert_to_breakpoint_profile(cn_profile, 2);
-        bp_profiles[name] = bp_profile;
+    int num_threads = distance.get<int>("--threads");
+    if (num_threads < 1) {
+        throw std::runtime_error("--threads must be at least 1.");
     }
 
-    auto [names, distance_matrix] = build_distance_matrix(bp_profiles);
+    thread_pool pool(num_threads);
+
+    breakpoint_matrix profiles = load_breakpoint_profiles(distance.get<std::string>("cn_profile"), pool);
+    auto [names, distances] = build_distance_matrix(profiles, pool);
 
     std::ofstream matrix_output(distance.get<std::string>("-o") + "_dist_matrix.csv", std::ios::out);
     for (std::vector<int>::size_type i = 0; i < names.size(); i++) {
@@ -114,90 +111,244 @@ void do_distance(argparse::ArgumentParser distance) {
     for (std::vector<int>::size_type i = 0; i < names.size(); i++) {
         matrix_output << names[i];
         for (std::vector<int>::size_type j = 0; j < names.size(); j++) {
-            matrix_output << "," << distance_matrix[i][j];
+            matrix_output << "," << distances(i, j);
         }
         matrix_output << std::endl;
     }
 
 
-    std::ofstream matrix_output_txt(distance.get<std::string>("-o") + "_dist_matrix.txt", std::ios::out);
-    matrix_output_txt << names.size() << std::endl;
-    for (std::vector<int>::size_type i = 0; i < names.size(); i++) {
-        matrix_output_txt << names[i];
-        for (std::vector<int>::size_type j = 0; j < names.size(); j++) {
-            matrix_output_txt << " " << distance_matrix[i][j];
-        }
-        matrix_output_txt << std::endl;
+    write_distance_matrix(distance.get<std::string>("-o") + "_dist_matrix.txt", names, distances);
+}
+
+void do_convert(argparse::ArgumentParser convert) {
+    int num_threads = convert.get<int>("--threads");
+    if (num_threads < 1) {
+        throw std::runtime_error("--threads must be at least 1.");
     }
+
+    thread_pool pool(num_threads);
+
+    breakpoint_matrix profiles = load_breakpoint_profiles(convert.get<std::string>("cn_profile"), pool);
+
+    std::string cache_file = convert.get<std::string>("-o");
+    spdlog::info("Writing breakpoint profile cache to file: {}", cache_file);
+    write_profile_cache(cache_file, profiles);
 }
 
-void do_nni(argparse::ArgumentParser nni) {
+/*
+  Logs the candidate tree scores of an iteration and appends them
+  to the progress information written to the info JSON.
+*/
+void record_candidate_scores(std::vector<int> scores, int iteration, json& progress_information) {
+    std::sort(scores.begin(), scores.end(), std::greater<int>());
+
+    json progress_information_i;
+    progress_information_i["scores"] = scores;
+    progress_information_i["iteration"] = iteration;
+    progress_information.push_back(progress_information_i);
+
     std::stringstream printer_stream;
     pprint::PrettyPrinter printer(printer_stream);
     printer.compact(true);
 
-    /* Load copy number profiles */
-    std::map<std::string, copynumber_profile> cn_profiles = read_cn_profiles(nni.get<std::string>("cn_profile"));
-    std::map<std::string, breakpoint_profile> bp_profiles;
-    std::vector<genomic_bin> sorted_bins;
-    for (const auto &[name, cn_profile] : cn_profiles) {
-        auto bp_profile = convert_to_breakpoint_profile(cn_profile, 2);
-        bp_profiles[name] = bp_profile;
-        sorted_bins = bp_profile.bins;
+    printer.print(scores);
+    std::string candidate_scores_string = printer_stream.str();
+    candidate_scores_string = candidate_scores_string.substr(0, candidate_scores_string.length() - 1);
+    spdlog::info("Candidate tree scores @ iteration {}: {}", iteration, candidate_scores_string);
+}
+
+/*
+  Climbs ending in the topology of a member of the candidate set are
+  rejected instead of duplicating it.
+*/
+bool is_new_candidate(const std::vector<rectilinear_tree>& candidate_trees, const rectilinear_tree& t) {
+    return std::none_of(candidate_trees.begin(), candidate_trees.end(), [&](const rectilinear_tree& c) {
+        return c.topology == t.topology;
+    });
+}
+
+/*
+  Repeatedly perturbs and hill climbs a random member of the candidate
+  set, replacing the worst member whenever the result improves upon it.
+  Stops once max_iterations consecutive climbs failed to improve the
+  candidate set.
+*/
+json candidate_search(std::vector<rectilinear_tree>& candidate_trees, std::ranlux48_base& gen,
+                      const search_options& options, double max_aggression, int max_iterations) {
+    json progress_information;
+    int counter = 0, iteration = 0;
+    for (; counter < max_iterations; iteration++) {
+        for (auto& candidate_tree : candidate_trees) {
+            score_tree(candidate_tree, options);
+        }
+
+        std::sort(candidate_trees.begin(), candidate_trees.end(),
+                  [](const rectilinear_tree &a, const rectilinear_tree &b) {
+                      return a.tree[0].score > b.tree[0].score;
+        });
+
+        std::vector<int> scores;
+        for (auto& candidate_tree : candidate_trees) {
+            scores.push_back(candidate_tree.tree[0].score);
+        }
+
+        record_candidate_scores(scores, iteration, progress_information);
+
+        // Select and perturb candidate tree.
+        std::uniform_int_distribution<int> distrib(0, candidate_trees.size() - 1);
+        int candidate_tree_idx = distrib(gen);
+
+        rectilinear_tree candidate_tree = candidate_trees[candidate_tree_idx];
+        std::uniform_real_distribution<double> aggression_distrib(0, max_aggression);
+        candidate_tree = stochastic_nni(candidate_tree, gen, aggression_distrib(gen));
+        score_tree(candidate_tree, options);
+
+        rectilinear_tree updated_tree = hill_climb(std::move(candidate_tree), gen, options);
+        if (updated_tree.tree[0].score < candidate_trees[0].tree[0].score &&
+            is_new_candidate(candidate_trees, updated_tree)) {
+            candidate_trees[0] = updated_tree;
+            spdlog::info("Updated candidate tree set.");
+            counter = 0;
+            continue;
+        } 
+
+        counter++;
+    }
+
+    return progress_information;
+}
+
+/*
+  Hill climbs candidate trees concurrently on every thread of the pool.
+  Each worker repeatedly perturbs a random member of the shared
+  candidate set, hill climbs it and replaces the worst member if the
+  result improves upon it. Stops once max_iterations consecutive climbs
+  failed to improve the candidate set.
+
+  Workers draw from their own generators, seeded from gen, but the
+  order in which their climbs complete depends on scheduling, so the
+  result is only reproducible for a single thread.
+*/
+json parallel_candidate_search(std::vector<rectilinear_tree>& candidate_trees, std::ranlux48_base& gen,
+                               const search_options& options, double max_aggression, int max_iterations) {
+    thread_pool& pool = *options.pool;
+
+    std::vector<std::ranlux48_base> generators;
+    for (size_t i = 0; i < pool.size(); i++) {
+        generators.emplace_back(gen());
+    }
+
+    pool.parallel_for(candidate_trees.size(), [&](size_t i, size_t) {
+        score_tree(candidate_trees[i], options);
+    });
+
+    std::mutex candidate_mutex;
+    json progress_information;
+    int counter = 0, iteration = 0;
+
+    auto scores = [&]() {
+        std::vector<int> scores;
+        for (auto& candidate_tree : candidate_trees) {
+            scores.push_back(candidate_tree.tree[0].score);
+        }
+        return scores;
+    };
+
+    record_candidate_scores(scores(), iteration, progress_information);
+
+    pool.parallel_for(pool.size(), [&](size_t worker, size_t) {
+        std::ranlux48_base& worker_gen = generators[worker];
+        std::uniform_real_distribution<double> aggression_distrib(0, max_aggression);
+        std::uniform_int_distribution<int> distrib(0, candidate_trees.size() - 1);
+
+        while (true) {
+            rectilinear_tree candidate_tree;
+            {
+                std::lock_guard<std::mutex> lock(candidate_mutex);
+                if (counter >= max_iterations) return;
+                candidate_tree = candidate_trees[distrib(worker_gen)];
+            }
+
+            candidate_tree = stochastic_nni(candidate_tree, worker_gen, aggression_distrib(worker_gen));
+            score_tree(candidate_tree, options);
+            rectilinear_tree updated_tree = hill_climb(std::move(candidate_tree), worker_gen, options);
+
+            std::lock_guard<std::mutex> lock(candidate_mutex);
+            auto worst_tree = std::max_element(candidate_trees.begin(), candidate_trees.end(),
+                                               [](const rectilinear_tree &a, const rectilinear_tree &b) {
+                                                   return a.tree[0].score < b.tree[0].score;
+                                               });
+
+            iteration++;
+            if (updated_tree.tree[0].score < worst_tree->tree[0].score &&
+                is_new_candidate(candidate_trees, updated_tree)) {
+                *worst_tree = std::move(updated_tree);
+                spdlog::info("Updated candidate tree set.");
+                counter = 0;
+            } else {
+                counter++;
+            }
+
+            record_candidate_scores(scores(), iteration, progress_information);
+        }
+    });
+
+    return progress_information;
+}
+
+void do_nni(argparse::ArgumentParser nni) {
+    spdlog::info("Using {} interval kernels.", kernels::dispatch().name);
+
+    int num_threads = nni.get<int>("--threads");
+    if (num_threads < 1) {
+        throw std::runtime_error("--threads must be at least 1.");
     }
 
+    thread_pool pool(num_threads);
+    spdlog::info("Using {} thread(s).", pool.size());
+
+    /* Load breakpoint profiles */
+    breakpoint_matrix profiles = load_breakpoint_profiles(nni.get<std::string>("cn_profile"), pool);
+    shared_bin_table sorted_bins = profiles.bin_table();
+
     /* Load/initialize seed tree */
     digraph<treeio::newick_vertex_data> t;
     if (nni.get<std::string>("tree") == "") {
         spdlog::info("No seed tree provided for NNI inference, building tree using neighbor joining.");
-        auto [names, distance_matrix] = build_distance_matrix(bp_profiles);
-
-        /* Write distance matrix to file */
-        std::string distance_matrix_file = nni.get<std::string>("-o") + "_dist_matrix.txt";
-        std::ofstream matrix_output(distance_matrix_file, std::ios::out);
-        matrix_output << names.size() << std::endl;
-        for (std::vector<int>::size_type i = 0; i < names.size(); i++) {
-            matrix_output << names[i];
-            for (std::vector<int>::size_type j = 0; j < names.size(); j++) {
-                matrix_output << " " << distance_matrix[i][j];
-            }
-            matrix_output << std::endl;
+        auto [names, distances] = build_distance_matrix(profiles, pool);
+
+        if (nni.get<bool>("--write-distance-matrix")) {
+            std::string distance_matrix_file = nni.get<std::string>("-o") + "_dist_matrix.txt";
+            spdlog::info("Outputting distance matrix to file: {}", distance_matrix_file);
+            write_distance_matrix(distance_matrix_file, names, distances);
         }
 
         /* Build NJ tree using Clearcut algorithm */
-        std::string output_tree = nni.get<std::string>("-o") + "_nj_tree.newick";
         spdlog::info("Building NJ tree from distance matrix using neighbor joining.");
 
         init_genrand(nni.get<int>("-s"));
 
-        NJ_ARGS args;
-        args.infilename = (char*) distance_matrix_file.c_str();
+        std::string output_tree = nni.get<std::string>("-o") + "_nj_tree.newick";
+        NJ_ARGS args = {};
         args.stdin_flag = false;
         args.stdout_flag = false;
         args.outfilename = (char*) output_tree.c_str();
         args.ntrees = 1;
         args.expblen = 0;
 
-        DMAT* dmat = NJ_parse_distance_matrix(&args);
-        if (!dmat) {
-            throw std::runtime_error("Failed to parse distance matrix.");
-        }
-
+        DMAT* dmat = make_dmat(names, distances);
         NJ_shuffle_distance_matrix(dmat);
         NJ_TREE* tree = NJ_neighbor_joining(&args, dmat);
 
-        spdlog::info("Outputting NJ tree to file: {}", output_tree);
-        NJ_output_tree(&args, tree, dmat, 0);
+        if (nni.get<bool>("--write-nj-tree")) {
+            spdlog::info("Outputting NJ tree to file: {}", output_tree);
+            NJ_output_tree(&args, tree, dmat, 0);
+        }
+
+        t = from_nj_tree(tree, dmat);
 
         NJ_free_tree(tree);
         NJ_free_dmat(dmat);
-
-        /* Read NJ tree */
-        std::ifstream in(output_tree);
-        std::stringstream buffer;
-        buffer << in.rdbuf();
-        std::string seed_tree_newick = buffer.str();
-        t = treeio::read_newick_node(seed_tree_newick);
     } else {
         spdlog::info("Reading seed tree from file: {}", nni.get<std::string>("tree"));
 
@@ -209,107 +360,164 @@ void do_nni(argparse::ArgumentParser nni) {
     }
 
     /* Creates rectilinear vertex data */
-    digraph<breakpoint_vertex_data> breakpoint_tree;
-    digraph<rectilinear_vertex_data> rectilinear_tree;
-    for (auto u : t.nodes()) {
-        breakpoint_vertex_data d;
+    rectilinear_tree seed_tree;
+    seed_tree.tree = to_binary_tree<rectilinear_vertex_data>(t, [](const treeio::newick_vertex_data& d) {
         rectilinear_vertex_data r;
+        r.name = d.name;
+        return r;
+    });
 
-        const auto& vertex_data = t[u];
-        d.name = vertex_data.data.name;
-        r.name = vertex_data.data.name;
+    /* Collapses identical breakpoint columns into weighted site patterns */
+    auto patterns = std::make_shared<const site_patterns>(find_site_patterns(profiles));
+    spdlog::info("Compressed {} bins into {} site patterns.", sorted_bins->size(), patterns->num_patterns());
 
-        if (t.out_degree(u) == 0) {
-            d.breakpoint_profile = bp_profiles[d.name].profile;
-            r.start = bp_profiles[d.name].profile;
-            r.end = bp_profiles[d.name].profile;
-        } 
+    seed_tree.patterns = patterns;
+    hash_topology(seed_tree);
+    arena_layout layout = parse_arena_layout(nni.get<std::string>("--interval-layout"));
 
-        breakpoint_tree.add_vertex(d);
-        rectilinear_tree.add_vertex(r);
-    }
-
-    for (auto [u, v] : t.edges()) {
-        breakpoint_tree.add_edge(u, v);
-        rectilinear_tree.add_edge(u, v);
+    /*
+      Merging never leaves the range of the leaf values, so intervals
+      are stored in the narrowest type fitting the range of the
+      breakpoint profiles.
+     */
+    interval_type type = interval_type::i32;
+    if (profiles.rows() > 0) {
+        auto [lo, hi] = std::minmax_element(profiles.data(), profiles.data() + profiles.rows() * profiles.stride());
+        type = narrowest_interval_type(*lo, *hi);
     }
 
-    std::ranlux48_base gen(nni.get<int>("-s"));
+    spdlog::info("Storing intervals as {} bit integers.", 8 * interval_type_size(type));
 
     /*
-      Candidate tree set is obtained by randomly
-      perturbing candidate trees.
+      Under a memory budget, the arenas of every live tree (the
+      candidates and a working copy per thread) hold a single block
+      of site patterns, as wide as the budget allows.
      */
-    std::vector<digraph<rectilinear_vertex_data>> candidate_trees;
-    float aggressions[] = {0, 0.25, 0.50, 0.75, 1, 1.25, 1.5, 1.75};
-    for (float aggression : aggressions) {
-        digraph<rectilinear_vertex_data> t = stochastic_nni(rectilinear_tree, gen, aggression);
-        candidate_trees.push_back(t);
+    int memory_budget = nni.get<int>("--memory-budget");
+    if (memory_budget < 0) {
+        throw std::runtime_error("--memory-budget must be non-negative.");
     }
 
-    json progress_information;
-    int counter = 0, iteration = 0;
-    for (; counter < nni.get<int>("-i"); iteration++) {
-        for (auto& candidate_tree : candidate_trees) {
-            small_rectilinear(candidate_tree, 0);
+    std::optional<pattern_blocks> blocks;
+    size_t arena_patterns = patterns->num_patterns();
+    if (memory_budget > 0) {
+        size_t live_trees = std::max(nni.get<int>("--candidates"), 1) + pool.size() + 1;
+        size_t bytes_per_pattern = 2 * 2 * interval_type_size(type) * seed_tree.tree.size() * live_trees;
+        size_t block_width = std::max<size_t>(16, (size_t) memory_budget * 1024 * 1024 / bytes_per_pattern / 16 * 16);
+        if (block_width < patterns->num_patterns()) {
+            blocks.emplace(patterns, seed_tree.tree.size(), block_width);
+            arena_patterns = block_width;
+            spdlog::info("Evaluating trees in {} blocks of {} site patterns to fit the memory budget.",
+                         blocks->num_blocks(), block_width);
         }
+    }
 
-        std::sort(candidate_trees.begin(), candidate_trees.end(),
-                  [](const digraph<rectilinear_vertex_data> &a, const digraph<rectilinear_vertex_data> &b) {
-                      return a[0].data.score > b[0].data.score;
-        });
+    seed_tree.intervals = inside_arena(seed_tree.tree, arena_patterns, layout, type);
+    seed_tree.outside = interval_arena(seed_tree.tree.size(), arena_patterns, layout,
+                                       interval_arena::default_block_width, type);
 
-        std::vector<int> scores;
-        for (auto& candidate_tree : candidate_trees) {
-            scores.push_back(candidate_tree[0].data.score);
+    std::map<std::string, size_t> profile_rows;
+    for (size_t i = 0; i < profiles.rows(); i++) {
+        profile_rows[profiles.names()[i]] = i;
+    }
+
+    for (size_t u = 0; u < seed_tree.tree.size(); u++) {
+        if (!seed_tree.tree.is_leaf(u)) continue;
+
+        const std::string& name = seed_tree.tree[u].name;
+        auto row = profile_rows.find(name);
+        if (row == profile_rows.end()) {
+            throw std::runtime_error("No copy number profile for leaf " + name + ".");
+        }
+
+        const int* profile = profiles.row(row->second);
+        std::vector<int> leaf_profile(profile, profile + profiles.bins());
+        std::vector<int> leaf_patterns = patterns->compress(leaf_profile);
+        if (blocks) {
+            blocks->set_point(u, leaf_patterns.data());
+        } else {
+            seed_tree.intervals.set_point(u, leaf_patterns.data());
         }
+    }
 
-        json progress_information_i;
-        progress_information_i["scores"] = scores;
-        progress_information_i["iteration"] = iteration;
-        progress_information.push_back(progress_information_i);
+    std::ranlux48_base gen(nni.get<int>("-s"));
 
-        printer.print(scores);
-        std::string candidate_scores_string = printer_stream.str();
-        candidate_scores_string = candidate_scores_string.substr(0, candidate_scores_string.length() - 1);
-        spdlog::info("Candidate tree scores @ iteration {}: {}", iteration, candidate_scores_string);
-        printer_stream.str("");
+    search_options options;
+    options.greedy = nni.get<bool>("-g");
+    options.moves = parse_move_set(nni.get<std::string>("--moves"));
+    options.spr_radius = nni.get<int>("--spr-radius");
+    options.move_queue = nni.get<bool>("--move-queue");
+    options.batch = nni.get<bool>("--batch-nni");
+    options.pool = &pool;
+    options.shard_bins = nni.get<bool>("--shard-bins");
+    options.blocks = blocks ? &*blocks : nullptr;
+
+    std::optional<topology_cache> cache;
+    if (nni.get<int>("--topology-cache") > 0) {
+        cache.emplace(nni.get<int>("--topology-cache"));
+        options.cache = &*cache;
+    }
+    if (options.spr_radius < 1) {
+        throw std::runtime_error("--spr-radius must be at least 1.");
+    }
 
-        // Select and perturb candidate tree.
-        std::uniform_int_distribution<int> distrib(0, candidate_trees.size() - 1);
-        int candidate_tree_idx = distrib(gen);
+    if (nni.get<int>("--tbr-radius") < 1) {
+        throw std::runtime_error("--tbr-radius must be at least 1.");
+    }
 
-        digraph<rectilinear_vertex_data> candidate_tree = candidate_trees[candidate_tree_idx];
-        std::uniform_real_distribution<double> aggression_distrib(0, nni.get<double>("-a"));
-        stochastic_nni(candidate_tree, gen, aggression_distrib(gen));
+    /*
+      Candidate tree set is obtained by randomly
+      perturbing candidate trees.
+     */
+    int num_candidates = nni.get<int>("--candidates");
+    if (num_candidates < 1) {
+        throw std::runtime_error("--candidates must be at least 1.");
+    }
 
-        digraph<rectilinear_vertex_data> updated_tree = hill_climb(candidate_tree, gen, nni.get<bool>("-g"));
-        if (updated_tree[0].data.score < candidate_trees[0][0].data.score) {
-            candidate_trees[0] = updated_tree;
-            spdlog::info("Updated candidate tree set.");
-            counter = 0;
-            continue;
-        } 
+    std::vector<rectilinear_tree> candidate_trees;
+    for (int i = 0; i < num_candidates; i++) {
+        float aggression = 0.25f * i;
+        rectilinear_tree t = stochastic_nni(seed_tree, gen, aggression);
+        candidate_trees.push_back(t);
+    }
 
-        counter++;
+    json progress_information;
+    if (nni.get<bool>("--parallel-candidates")) {
+        spdlog::info("Hill climbing {} candidate trees on {} thread(s).", candidate_trees.size(), pool.size());
+        progress_information = parallel_candidate_search(candidate_trees, gen, options,
+                                                         nni.get<double>("-a"), nni.get<int>("-i"));
+    } else {
+        progress_information = candidate_search(candidate_trees, gen, options,
+                                                nni.get<double>("-a"), nni.get<int>("-i"));
     }
 
     for (auto& candidate_tree : candidate_trees) {
-        small_rectilinear(candidate_tree, 0);
+        score_tree(candidate_tree, options);
     }
 
     std::sort(candidate_trees.begin(), candidate_trees.end(),
-              [](const digraph<rectilinear_vertex_data> &a, const digraph<rectilinear_vertex_data> &b) {
-                  return a[0].data.score > b[0].data.score;
+              [](const rectilinear_tree &a, const rectilinear_tree &b) {
+                  return a.tree[0].score > b.tree[0].score;
               });
 
-    auto final_tree = ancestral_labeling(candidate_trees[candidate_trees.size() - 1], 0, sorted_bins);
+    rectilinear_tree& best_tree = candidate_trees[candidate_trees.size() - 1];
 
+    double tbr_time = nni.get<double>("--tbr-time");
+    if (tbr_time > 0) {
+        int score = best_tree.tree[0].score;
+        best_tree = tbr_polish(std::move(best_tree), options, nni.get<int>("--tbr-radius"), tbr_time);
+        spdlog::info("Polished the best tree with TBR moves from score {} to {}.", score, best_tree.tree[0].score);
+    }
+
+    auto final_tree = blocks ? ancestral_labeling(best_tree, 0, sorted_bins, *blocks, options.bin_pool())
+                             : ancestral_labeling(best_tree, 0, sorted_bins);
+
+    bin_order order = sort_bins(sorted_bins);
     digraph<copynumber_profile_vertex_data> final_cn_tree;
     for (auto u : final_tree.nodes()) {
         copynumber_profile_vertex_data d;
         d.name = final_tree[u].data.name;
-        d.profile = convert_to_copynumber_profile(final_tree[u].data.profile, 2);
+        d.profile = convert_to_copynumber_profile(final_tree[u].data.profile, order, 2);
         d.in_branch_length = final_tree[u].data.in_branch_length;
         final_cn_tree.add_vertex(d);
     }
@@ -331,8 +539,9 @@ void do_nni(argparse::ArgumentParser nni) {
     cn_profile_output << "node,chrom,allele,start,end,cn" << std::endl;
     for (auto u : final_cn_tree.nodes()) {
         auto& d = final_cn_tree[u].data;
+        const std::vector<genomic_bin>& bins = *d.profile.bins;
         for (std::vector<int>::size_type i = 0; i < d.profile.profile.size(); i++) {
-            cn_profile_output << d.name << "," << d.profile.bins[i].chromosome << "," << d.profile.bins[i].allele << "," << d.profile.bins[i].start << "," << d.profile.bins[i].end << "," << d.profile.profile[i] << std::endl;
+            cn_profile_output << d.name << "," << bins[i].chromosome << "," << bins[i].allele << "," << bins[i].start << "," << bins[i].end << "," << d.profile.profile[i] << std::endl;
         }
     }
 }
@@ -357,12 +566,35 @@ int main(int argc, char *argv[])
     distance.add_description("Computes a distance matrix on copy number profiles");
 
     distance.add_argument("cn_profile")
-        .help("copy number profile in CSV format");
+        .help("copy number profile in CSV format or a profile cache written by convert");
 
     distance.add_argument("-o", "--output")
         .help("prefix of the output files")
         .required();
 
+    distance.add_argument("--threads")
+        .help("number of threads used to read the profiles and compute the distance matrix")
+        .default_value(1)
+        .scan<'d', int>();
+
+    argparse::ArgumentParser convert(
+        "convert"
+    );
+
+    convert.add_description("Converts copy number profiles into a binary breakpoint profile cache");
+
+    convert.add_argument("cn_profile")
+        .help("copy number profile in CSV format");
+
+    convert.add_argument("-o", "--output")
+        .help("output profile cache")
+        .required();
+
+    convert.add_argument("--threads")
+        .help("number of threads used to read the profiles")
+        .default_value(1)
+        .scan<'d', int>();
+
     argparse::ArgumentParser nni(
         "nni"
     );
@@ -370,7 +602,7 @@ int main(int argc, char *argv[])
     nni.add_description("Infers a copy number tree using NNI operations");
 
     nni.add_argument("cn_profile")
-        .help("copy number profile in CSV format");
+        .help("copy number profile in CSV format or a profile cache written by convert");
 
     nni.add_argument("-t", "--tree")
         .help("seed tree in Newick format.")
@@ -395,13 +627,87 @@ int main(int argc, char *argv[])
         .default_value(false)
         .implicit_value(true);
 
+    nni.add_argument("--moves")
+        .help("moves explored by hill climbing, either nni or spr (subtree prune and regraft)")
+        .default_value(std::string("nni"));
+
+    nni.add_argument("--spr-radius")
+        .help("maximum number of edges a subtree is moved by an SPR move")
+        .default_value(3)
+        .scan<'d', int>();
+
+    nni.add_argument("--move-queue")
+        .help("keep NNI gains in a priority queue, re-evaluating only the moves around each applied NNI")
+        .default_value(false)
+        .implicit_value(true);
+
+    nni.add_argument("--batch-nni")
+        .help("apply all non-conflicting improving NNIs of a neighborhood at once, falling back to the best one if the batch is no better")
+        .default_value(false)
+        .implicit_value(true);
+
+    nni.add_argument("--topology-cache")
+        .help("number of local optima whose topologies are remembered, stopping climbs that reach one (0 to disable)")
+        .default_value(0)
+        .scan<'d', int>();
+
+    nni.add_argument("--tbr-time")
+        .help("time budget in seconds for polishing the best tree with TBR moves after the search (0 to skip)")
+        .default_value(0.0)
+        .scan<'g', double>();
+
+    nni.add_argument("--tbr-radius")
+        .help("maximum number of edges a subtree is rerooted and moved by a TBR move")
+        .default_value(2)
+        .scan<'d', int>();
+
     nni.add_argument("-s", "--seed")
         .help("seed for random number generator")
         .default_value(0)
         .scan<'d', int>();
 
+    nni.add_argument("--write-distance-matrix")
+        .help("write the distance matrix used to build the NJ seed tree to PREFIX_dist_matrix.txt")
+        .default_value(false)
+        .implicit_value(true);
+
+    nni.add_argument("--write-nj-tree")
+        .help("write the NJ seed tree to PREFIX_nj_tree.newick")
+        .default_value(false)
+        .implicit_value(true);
+
+    nni.add_argument("--interval-layout")
+        .help("memory layout of the interval arena, either node-major or bin-major")
+        .default_value(std::string("node-major"));
+
+    nni.add_argument("--threads")
+        .help("number of threads used to read the profiles, build the distance matrix and score NNI neighborhoods")
+        .default_value(1)
+        .scan<'d', int>();
+
+    nni.add_argument("--candidates")
+        .help("number of candidate trees kept during the search")
+        .default_value(8)
+        .scan<'d', int>();
+
+    nni.add_argument("--shard-bins")
+        .help("also split every tree evaluation into shards of bins run on the threads, for very wide profiles over few cells")
+        .default_value(false)
+        .implicit_value(true);
+
+    nni.add_argument("--memory-budget")
+        .help("approximate memory in MB for the intervals of all trees, evaluating them in blocks of site patterns if exceeded (0 for no limit)")
+        .default_value(0)
+        .scan<'d', int>();
+
+    nni.add_argument("--parallel-candidates")
+        .help("hill climb candidate trees concurrently, one per thread, instead of scoring neighborhoods in parallel")
+        .default_value(false)
+        .implicit_value(true);
+
     program.add_subparser(nni);
     program.add_subparser(distance);
+    program.add_subparser(convert);
     
     try {
         program.parse_args(argc, argv);
@@ -412,6 +718,8 @@ int main(int argc, char *argv[])
             std::cerr << nni;
         } else if (program.is_subcommand_used(distance)) {
             std::cerr << distance;
+        } else if (program.is_subcommand_used(convert)) {
+            std::cerr << convert;
         } else {
             std::cerr << program;
         }
@@ -423,6 +731,8 @@ int main(int argc, char *argv[])
         do_nni(nni);
     } else if (program.is_subcommand_used(distance)) {
         do_distance(distance);
+    } else if (program.is_subcommand_used(convert)) {
+        do_convert(convert);
     } else {
         std::cerr << program;
     }
@@ -0,0 +1,110 @@
+#include "neighbor_joining.hpp"
+#include "common.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <stack>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+namespace copynumber {
+    namespace {
+        template <class T>
+        T* allocate(size_t n) {
+            T* p = static_cast<T*>(calloc(n, sizeof(T)));
+            if (!p) throw std::bad_alloc();
+            return p;
+        }
+
+        /*
+          NJ_output_tree prints an internal vertex with a single
+          child as just that child, so such vertices are skipped.
+         */
+        const NJ_TREE* skip_unary(const NJ_TREE* node) {
+            while (node->taxa_index == NJ_INTERNAL_NODE && (!node->left != !node->right)) {
+                node = node->left ? node->left : node->right;
+            }
+
+            return node;
+        }
+    };
+
+    DMAT* make_dmat(const std::vector<std::string>& names, const distance_matrix& d) {
+        if (names.size() < 2) {
+            throw std::runtime_error("Neighbor joining requires at least two cells.");
+        }
+
+        // allocated with calloc to be released by NJ_free_dmat
+        DMAT* dmat = allocate<DMAT>(1);
+        dmat->ntaxa = names.size();
+        dmat->size = names.size();
+
+        try {
+            dmat->taxaname = allocate<char*>(names.size());
+            for (size_t i = 0; i < names.size(); i++) {
+                dmat->taxaname[i] = allocate<char>(names[i].size() + 1);
+                std::memcpy(dmat->taxaname[i], names[i].c_str(), names[i].size());
+            }
+
+            dmat->val = allocate<float>(NJ_NCELLS(dmat->ntaxa));
+            dmat->valhandle = dmat->val;
+            for (long int i = 0; i < dmat->ntaxa; i++) {
+                for (long int j = i + 1; j < dmat->ntaxa; j++) {
+                    dmat->val[NJ_MAP(i, j, dmat->size)] = d(i, j);
+                }
+            }
+
+            dmat->r = allocate<float>(dmat->ntaxa);
+            dmat->rhandle = dmat->r;
+            dmat->r2 = allocate<float>(dmat->ntaxa);
+            dmat->r2handle = dmat->r2;
+        } catch (...) {
+            NJ_free_dmat(dmat);
+            throw;
+        }
+
+        return dmat;
+    }
+
+    digraph<treeio::newick_vertex_data> from_nj_tree(const NJ_TREE* tree, const DMAT* dmat) {
+        digraph<treeio::newick_vertex_data> t;
+
+        // vertices are created in preorder, as in the Newick parser,
+        // and the stack holds each vertex along with its parent
+        int internal_counter = 0;
+        std::stack<std::pair<const NJ_TREE*, int>> callstack;
+        callstack.push(std::make_pair(skip_unary(tree), -1));
+        while (!callstack.empty()) {
+            auto [node, parent] = callstack.top();
+            callstack.pop();
+
+            bool internal = node->taxa_index == NJ_INTERNAL_NODE;
+
+            treeio::newick_vertex_data d;
+            if (parent == -1) {
+                d.name = "root";
+            } else if (internal) {
+                d.name = "internal_" + std::to_string(internal_counter++);
+            }
+
+            if (!internal) {
+                d.name = dmat->taxaname[node->taxa_index];
+            }
+
+            int u = t.add_vertex(d);
+            if (parent != -1) {
+                t.add_edge(parent, u);
+            }
+
+            if (!internal) continue;
+            for (const NJ_TREE* child : {node->right, node->left}) {
+                if (!child) continue;
+                callstack.push(std::make_pair(skip_unary(child), u));
+            }
+        }
+
+        return t;
+    }
+};
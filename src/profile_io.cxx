@@ -0,0 +1,760 @@
+#include "profile_io.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <charconv>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <thread>
+#include <unordered_map>
+
+namespace copynumber {
+    namespace {
+        // chunks are at least this many bytes, so small
+        // files are not split for nothing
+        constexpr size_t min_chunk_size = 1 << 20;
+
+        struct csv_columns {
+            size_t node, chrom, start, end, cn;
+            size_t count;
+        };
+
+        struct bin_key {
+            int chrom;
+            int start;
+            int end;
+
+            bool operator==(const bin_key& other) const {
+                return chrom == other.chrom && start == other.start && end == other.end;
+            }
+        };
+
+        struct bin_key_hash {
+            size_t operator()(const bin_key& k) const {
+                size_t h = std::hash<int>()(k.chrom);
+                h = h * 31 + std::hash<int>()(k.start);
+                h = h * 31 + std::hash<int>()(k.end);
+                return h;
+            }
+        };
+
+        /*
+          Rows of one chunk of the file, with cells, chromosomes and
+          bins interned to chunk local ids in order of first appearance.
+          Names are copied out of the chunk, so the text of a chunk
+          can be released once it is parsed.
+         */
+        struct parsed_chunk {
+            std::vector<std::string> cells;
+            std::vector<std::string> chroms;
+            std::vector<bin_key> bins;
+            std::vector<std::array<int, 3>> rows; // (cell, bin, copy number)
+        };
+
+        std::string_view unquote(std::string_view field) {
+            if (field.size() >= 2 && field.front() == '"' && field.back() == '"') {
+                return field.substr(1, field.size() - 2);
+            }
+
+            return field;
+        }
+
+        void split_fields(std::string_view line, std::vector<std::string_view>& fields) {
+            fields.clear();
+
+            size_t begin = 0;
+            while (true) {
+                size_t end = line.find(',', begin);
+                if (end == std::string_view::npos) {
+                    fields.push_back(unquote(line.substr(begin)));
+                    return;
+                }
+
+                fields.push_back(unquote(line.substr(begin, end - begin)));
+                begin = end + 1;
+            }
+        }
+
+        /*
+          Returns the next line of text starting at position,
+          without its line terminator, and advances position
+          past it.
+         */
+        std::string_view next_line(std::string_view text, size_t& position) {
+            size_t end = text.find('\n', position);
+            if (end == std::string_view::npos) end = text.size();
+
+            std::string_view line = text.substr(position, end - position);
+            position = end + 1;
+
+            if (!line.empty() && line.back() == '\r') line.remove_suffix(1);
+            return line;
+        }
+
+        int parse_int(std::string_view field) {
+            int value;
+            auto [ptr, ec] = std::from_chars(field.data(), field.data() + field.size(), value);
+            if (ec != std::errc() || ptr != field.data() + field.size() || field.empty()) {
+                throw std::runtime_error("Malformed integer '" + std::string(field) + "' in copy number profile.");
+            }
+
+            return value;
+        }
+
+        csv_columns parse_header(std::string_view line) {
+            std::vector<std::string_view> fields;
+            split_fields(line, fields);
+
+            auto column = [&](std::string_view name) {
+                for (size_t i = 0; i < fields.size(); i++) {
+                    if (fields[i] == name) return i;
+                }
+
+                throw std::runtime_error("Copy number profile is missing the " + std::string(name) + " column.");
+            };
+
+            csv_columns columns;
+            columns.node = column("node");
+            columns.chrom = column("chrom");
+            columns.start = column("start");
+            columns.end = column("end");
+            columns.cn = column("cn_a");
+            columns.count = fields.size();
+            return columns;
+        }
+
+        template <class K, class H = std::hash<K>>
+        int intern(std::unordered_map<K, int, H>& ids, std::vector<K>& keys, const K& key) {
+            auto [it, inserted] = ids.try_emplace(key, keys.size());
+            if (inserted) keys.push_back(key);
+            return it->second;
+        }
+
+        void parse_chunk(std::string_view text, const csv_columns& columns, parsed_chunk& chunk) {
+            std::unordered_map<std::string_view, int> cell_ids, chrom_ids;
+            std::unordered_map<bin_key, int, bin_key_hash> bin_ids;
+            std::vector<std::string_view> cells, chroms;
+
+            std::vector<std::string_view> fields;
+            size_t position = 0;
+            while (position < text.size()) {
+                std::string_view line = next_line(text, position);
+                if (line.empty()) continue;
+
+                split_fields(line, fields);
+                if (fields.size() != columns.count) {
+                    throw std::runtime_error("Expected " + std::to_string(columns.count) + " fields in copy number profile row '" +
+                                             std::string(line) + "'.");
+                }
+
+                bin_key bin;
+                bin.chrom = intern(chrom_ids, chroms, fields[columns.chrom]);
+                bin.start = parse_int(fields[columns.start]);
+                bin.end = parse_int(fields[columns.end]);
+
+                int cell = intern(cell_ids, cells, fields[columns.node]);
+                int cn = parse_int(fields[columns.cn]);
+                chunk.rows.push_back({cell, intern(bin_ids, chunk.bins, bin), cn});
+            }
+
+            chunk.cells.assign(cells.begin(), cells.end());
+            chunk.chroms.assign(chroms.begin(), chroms.end());
+        }
+
+        /*
+          Splits text into at most n chunks of roughly
+          equal size, each ending on a line boundary.
+         */
+        std::vector<std::string_view> split_chunks(std::string_view text, size_t n) {
+            std::vector<std::string_view> chunks;
+
+            size_t begin = 0;
+            for (size_t i = 1; i <= n && begin < text.size(); i++) {
+                size_t end = text.size() * i / n;
+                if (end < begin) end = begin;
+
+                end = text.find('\n', end);
+                end = end == std::string_view::npos ? text.size() : end + 1;
+
+                chunks.push_back(text.substr(begin, end - begin));
+                begin = end;
+            }
+
+            return chunks;
+        }
+
+        /*
+          Inflates a gzip stream on a background thread into blocks of
+          decompressed text, handed to the consumer through a bounded
+          queue. Concatenated members (e.g. bgzip files) are inflated
+          one after another.
+         */
+        class gzip_reader {
+        private:
+            static constexpr size_t block_size = 1 << 22;
+
+            std::string_view input;
+            size_t capacity;
+
+            std::mutex mutex;
+            std::condition_variable changed;
+            std::deque<std::string> blocks;
+            bool finished = false;
+            bool cancelled = false;
+            std::exception_ptr error;
+
+            std::thread worker;
+
+            // returns false if the consumer went away
+            bool push(std::string block) {
+                std::unique_lock<std::mutex> lock(mutex);
+                changed.wait(lock, [&] { return cancelled || blocks.size() < capacity; });
+                if (cancelled) return false;
+
+                blocks.push_back(std::move(block));
+                changed.notify_all();
+                return true;
+            }
+
+            void inflate_all() {
+                z_stream stream = {};
+                if (inflateInit2(&stream, 15 + 32) != Z_OK) {
+                    throw std::runtime_error("Failed to initialize gzip decompression.");
+                }
+
+                std::unique_ptr<z_stream, int (*)(z_stream*)> guard(&stream, inflateEnd);
+
+                size_t offset = 0;
+                bool end_of_input = false;
+                while (!end_of_input) {
+                    std::string block(block_size, '\0');
+                    stream.next_out = reinterpret_cast<Bytef*>(block.data());
+                    stream.avail_out = block.size();
+
+                    while (stream.avail_out > 0) {
+                        // zlib counts input in 32-bit integers
+                        if (stream.avail_in == 0 && offset < input.size()) {
+                            size_t n = std::min<size_t>(input.size() - offset, 1 << 30);
+                            stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(input.data() + offset));
+                            stream.avail_in = n;
+                            offset += n;
+                        }
+
+                        int ret = inflate(&stream, Z_NO_FLUSH);
+                        if (ret == Z_STREAM_END) {
+                            if (stream.avail_in == 0 && offset == input.size()) {
+                                end_of_input = true;
+                                break;
+                            }
+
+                            inflateReset(&stream);
+                        } else if (ret == Z_BUF_ERROR && stream.avail_in == 0 && offset == input.size()) {
+                            throw std::runtime_error("Unexpected end of gzip compressed input.");
+                        } else if (ret != Z_OK && ret != Z_BUF_ERROR) {
+                            throw std::runtime_error(std::string("Failed to decompress gzip input: ") +
+                                                     (stream.msg ? stream.msg : "corrupt data") + ".");
+                        }
+                    }
+
+                    block.resize(block.size() - stream.avail_out);
+                    if (!push(std::move(block))) return;
+                }
+            }
+
+            void run() {
+                try {
+                    inflate_all();
+                } catch (...) {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    error = std::current_exception();
+                }
+
+                std::lock_guard<std::mutex> lock(mutex);
+                finished = true;
+                changed.notify_all();
+            }
+
+        public:
+            gzip_reader(std::string_view input, size_t capacity) :
+                input(input), capacity(std::max<size_t>(capacity, 1)) {
+                worker = std::thread(&gzip_reader::run, this);
+            }
+
+            ~gzip_reader() {
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    cancelled = true;
+                    changed.notify_all();
+                }
+
+                worker.join();
+            }
+
+            /*
+              Moves the next block of decompressed text into block,
+              returning false once the input is exhausted. Rethrows
+              any error raised while inflating.
+             */
+            bool next(std::string& block) {
+                std::unique_lock<std::mutex> lock(mutex);
+                changed.wait(lock, [&] { return finished || !blocks.empty(); });
+
+                if (!blocks.empty()) {
+                    block = std::move(blocks.front());
+                    blocks.pop_front();
+                    changed.notify_all();
+                    return true;
+                }
+
+                if (error) std::rethrow_exception(error);
+                return false;
+            }
+        };
+
+        /*
+          Combines parsed chunks, in file order, into a dense matrix.
+          Chunk local ids are mapped to global ids keeping the order
+          of first appearance.
+         */
+        copynumber_matrix merge_chunks(const std::vector<parsed_chunk>& parsed) {
+            copynumber_matrix m;
+            std::unordered_map<std::string_view, int> cell_ids, chrom_ids;
+            std::unordered_map<bin_key, int, bin_key_hash> bin_ids;
+            std::vector<std::string_view> cells, chroms;
+            std::vector<bin_key> bins;
+
+            std::vector<std::vector<int>> cell_map(parsed.size()), bin_map(parsed.size());
+            for (size_t i = 0; i < parsed.size(); i++) {
+                for (std::string_view cell : parsed[i].cells) {
+                    cell_map[i].push_back(intern(cell_ids, cells, cell));
+                }
+
+                std::vector<int> chrom_map;
+                for (std::string_view chrom : parsed[i].chroms) {
+                    chrom_map.push_back(intern(chrom_ids, chroms, chrom));
+                }
+
+                for (bin_key bin : parsed[i].bins) {
+                    bin.chrom = chrom_map[bin.chrom];
+                    bin_map[i].push_back(intern(bin_ids, bins, bin));
+                }
+            }
+
+            for (std::string_view cell : cells) {
+                m.cells.push_back(std::string(cell));
+            }
+
+            for (const bin_key& bin : bins) {
+                m.bins.push_back(genomic_bin(std::string(chroms[bin.chrom]), "cn_a", bin.start, bin.end));
+            }
+
+            auto bin_string = [&](size_t bin) {
+                const genomic_bin& b = m.bins[bin];
+                return b.chromosome + ":" + std::to_string(b.start) + "-" + std::to_string(b.end);
+            };
+
+            m.data.assign(m.cells.size() * m.bins.size(), 0);
+            std::vector<char> filled(m.data.size(), false);
+            for (size_t i = 0; i < parsed.size(); i++) {
+                for (auto [cell, bin, cn] : parsed[i].rows) {
+                    size_t c = cell_map[i][cell], b = bin_map[i][bin];
+                    if (filled[c * m.bins.size() + b]) {
+                        throw std::runtime_error("Cell " + m.cells[c] + " has several copy numbers for bin " + bin_string(b) + ".");
+                    }
+
+                    m.row(c)[b] = cn;
+                    filled[c * m.bins.size() + b] = true;
+                }
+            }
+
+            for (size_t c = 0; c < m.cells.size(); c++) {
+                for (size_t b = 0; b < m.bins.size(); b++) {
+                    if (!filled[c * m.bins.size() + b]) {
+                        throw std::runtime_error("Cell " + m.cells[c] + " has no copy number for bin " + bin_string(b) + ".");
+                    }
+                }
+            }
+
+            return m;
+        }
+
+        void parse_chunks(const std::vector<std::string_view>& chunks, const csv_columns& columns,
+                          std::vector<parsed_chunk>& parsed, thread_pool* pool) {
+            size_t first = parsed.size();
+            parsed.resize(first + chunks.size());
+
+            auto parse = [&](size_t i, size_t) {
+                parse_chunk(chunks[i], columns, parsed[first + i]);
+            };
+
+            if (pool != nullptr) {
+                pool->parallel_for(chunks.size(), parse);
+            } else {
+                for (size_t i = 0; i < chunks.size(); i++) parse(i, 0);
+            }
+        }
+
+        copynumber_matrix read_plain_matrix(std::string_view text, thread_pool* pool) {
+            size_t position = 0;
+            csv_columns columns = parse_header(next_line(text, position));
+            std::string_view body = position < text.size() ? text.substr(position) : std::string_view();
+
+            size_t num_chunks = pool == nullptr ? 1 : 4 * pool->size();
+            num_chunks = std::max<size_t>(1, std::min(num_chunks, body.size() / min_chunk_size));
+
+            std::vector<parsed_chunk> parsed;
+            parse_chunks(split_chunks(body, num_chunks), columns, parsed, pool);
+            return merge_chunks(parsed);
+        }
+
+        /*
+          Parses the text inflated by a gzip_reader. Complete lines are
+          cut out of the decompressed blocks as they arrive and parsed
+          in batches, one block per thread, while the reader keeps
+          inflating in the background.
+         */
+        copynumber_matrix read_gzip_matrix(std::string_view input, thread_pool* pool) {
+            size_t batch_size = pool == nullptr ? 1 : pool->size();
+            gzip_reader reader(input, 2 * batch_size);
+
+            std::optional<csv_columns> columns;
+            std::vector<parsed_chunk> parsed;
+            std::vector<std::string> batch;
+
+            auto flush = [&]() {
+                if (!columns) {
+                    size_t position = 0;
+                    columns = parse_header(next_line(batch.front(), position));
+                    batch.front().erase(0, std::min(position, batch.front().size()));
+                }
+
+                std::vector<std::string_view> chunks(batch.begin(), batch.end());
+                parse_chunks(chunks, *columns, parsed, pool);
+                batch.clear();
+            };
+
+            std::string block, carry;
+            while (reader.next(block)) {
+                size_t last = block.rfind('\n');
+                if (last == std::string::npos) {
+                    carry += block;
+                    continue;
+                }
+
+                std::string text = std::move(carry);
+                text.append(block, 0, last + 1);
+                carry.assign(block, last + 1, std::string::npos);
+
+                batch.push_back(std::move(text));
+                if (batch.size() == batch_size) flush();
+            }
+
+            if (!carry.empty()) batch.push_back(std::move(carry));
+            if (!batch.empty() || !columns) {
+                if (batch.empty()) batch.push_back(std::string());
+                flush();
+            }
+
+            return merge_chunks(parsed);
+        }
+
+        constexpr char cache_magic[8] = {'L', 'A', 'Z', 'A', 'C', 'B', 'P', '\0'};
+        constexpr uint32_t cache_version = 1;
+        constexpr uint32_t cache_byte_order = 0x01020304;
+
+        struct cache_header {
+            char magic[8];
+            uint32_t version;
+            uint32_t byte_order;
+            uint64_t num_cells;
+            uint64_t num_bins;
+            uint64_t stride;
+            uint64_t strings_offset;
+            uint64_t bins_offset;
+            uint64_t cells_offset;
+            uint64_t matrix_offset;
+            uint64_t file_size;
+            uint32_t checksum; // CRC-32 of bytes [sizeof(cache_header), file_size)
+            uint32_t reserved;
+        };
+
+        struct cache_bin {
+            uint32_t chromosome; // string table ids
+            uint32_t allele;
+            int32_t start;
+            int32_t end;
+        };
+
+        uint64_t align(uint64_t offset, uint64_t alignment) {
+            return (offset + alignment - 1) / alignment * alignment;
+        }
+
+        uint32_t update_crc(uint32_t crc, const char* p, size_t n) {
+            while (n > 0) {
+                uInt len = std::min<size_t>(n, 1 << 30);
+                crc = crc32(crc, reinterpret_cast<const Bytef*>(p), len);
+                p += len;
+                n -= len;
+            }
+
+            return crc;
+        }
+
+        /*
+          Output stream tracking the offset and the
+          checksum of everything written through it.
+         */
+        class checksummed_output {
+        private:
+            std::ofstream& out;
+
+        public:
+            uint64_t offset;
+            uint32_t crc = crc32(0, Z_NULL, 0);
+
+            checksummed_output(std::ofstream& out, uint64_t offset) : out(out), offset(offset) {};
+
+            void write(const void* p, size_t n) {
+                out.write(static_cast<const char*>(p), n);
+                crc = update_crc(crc, static_cast<const char*>(p), n);
+                offset += n;
+            }
+
+            void pad_to(uint64_t target) {
+                static const char zeros[64] = {};
+                while (offset < target) {
+                    write(zeros, std::min<uint64_t>(target - offset, sizeof(zeros)));
+                }
+            }
+        };
+
+        [[noreturn]] void invalid_cache(const std::string& filename, const std::string& reason) {
+            throw std::runtime_error(filename + " is not a valid profile cache: " + reason + ".");
+        }
+    };
+
+    mapped_file::mapped_file(const std::string& filename) {
+        int fd = open(filename.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error("Failed to open " + filename + ": " + std::strerror(errno));
+        }
+
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            close(fd);
+            throw std::runtime_error("Failed to stat " + filename + ": " + std::strerror(errno));
+        }
+
+        size_ = st.st_size;
+        if (size_ > 0) {
+            void* p = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p == MAP_FAILED) {
+                close(fd);
+                throw std::runtime_error("Failed to map " + filename + ": " + std::strerror(errno));
+            }
+
+            madvise(p, size_, MADV_SEQUENTIAL);
+            data_ = static_cast<const char*>(p);
+        }
+
+        close(fd);
+    }
+
+    mapped_file::~mapped_file() {
+        if (data_) munmap(const_cast<char*>(data_), size_);
+    }
+
+    copynumber_matrix read_copynumber_matrix(const std::string& filename, thread_pool* pool) {
+        mapped_file file(filename);
+        std::string_view text = file.view();
+
+        if (text.size() >= 2 && text[0] == '\x1f' && text[1] == '\x8b') {
+            return read_gzip_matrix(text, pool);
+        }
+
+        return read_plain_matrix(text, pool);
+    }
+
+    void write_profile_cache(const std::string& filename, const breakpoint_matrix& m) {
+        /* Interns all strings into the string table */
+        std::unordered_map<std::string, uint32_t> string_ids;
+        std::vector<const std::string*> strings;
+        auto intern_string = [&](const std::string& str) {
+            auto [it, inserted] = string_ids.try_emplace(str, strings.size());
+            if (inserted) strings.push_back(&it->first);
+            return it->second;
+        };
+
+        std::vector<cache_bin> bins;
+        for (const genomic_bin& bin : *m.bin_table()) {
+            bins.push_back({intern_string(bin.chromosome), intern_string(bin.allele), bin.start, bin.end});
+        }
+
+        std::vector<uint32_t> cells;
+        for (const std::string& name : m.names()) {
+            cells.push_back(intern_string(name));
+        }
+
+        cache_header header = {};
+        std::memcpy(header.magic, cache_magic, sizeof(cache_magic));
+        header.version = cache_version;
+        header.byte_order = cache_byte_order;
+        header.num_cells = m.rows();
+        header.num_bins = m.bins();
+        header.stride = m.stride();
+
+        uint64_t strings_size = sizeof(uint64_t);
+        for (const std::string* str : strings) {
+            strings_size += sizeof(uint32_t) + str->size();
+        }
+
+        header.strings_offset = sizeof(cache_header);
+        header.bins_offset = align(header.strings_offset + strings_size, 8);
+        header.cells_offset = header.bins_offset + bins.size() * sizeof(cache_bin);
+        header.matrix_offset = align(header.cells_offset + cells.size() * sizeof(uint32_t), 64);
+        header.file_size = header.matrix_offset + m.rows() * m.stride() * sizeof(int);
+
+        std::ofstream out(filename, std::ios::out | std::ios::binary);
+        if (!out) {
+            throw std::runtime_error("Failed to open " + filename + " for writing.");
+        }
+
+        // the header is rewritten with the checksum at the end
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+        checksummed_output payload(out, sizeof(header));
+        uint64_t num_strings = strings.size();
+        payload.write(&num_strings, sizeof(num_strings));
+        for (const std::string* str : strings) {
+            uint32_t length = str->size();
+            payload.write(&length, sizeof(length));
+            payload.write(str->data(), str->size());
+        }
+
+        payload.pad_to(header.bins_offset);
+        payload.write(bins.data(), bins.size() * sizeof(cache_bin));
+        payload.write(cells.data(), cells.size() * sizeof(uint32_t));
+        payload.pad_to(header.matrix_offset);
+        payload.write(m.data(), m.rows() * m.stride() * sizeof(int));
+
+        header.checksum = payload.crc;
+        out.seekp(0);
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+        if (!out) {
+            throw std::runtime_error("Failed to write " + filename + ".");
+        }
+    }
+
+    bool is_profile_cache(const std::string& filename) {
+        char magic[sizeof(cache_magic)] = {};
+        std::ifstream in(filename, std::ios::in | std::ios::binary);
+        in.read(magic, sizeof(magic));
+        return in && std::memcmp(magic, cache_magic, sizeof(magic)) == 0;
+    }
+
+    breakpoint_matrix read_profile_cache(const std::string& filename) {
+        mapped_file file(filename);
+        std::string_view text = file.view();
+
+        cache_header header;
+        if (text.size() < sizeof(header)) invalid_cache(filename, "truncated header");
+        std::memcpy(&header, text.data(), sizeof(header));
+
+        if (std::memcmp(header.magic, cache_magic, sizeof(cache_magic)) != 0) invalid_cache(filename, "bad magic number");
+        if (header.byte_order != cache_byte_order) invalid_cache(filename, "written on a machine of different byte order");
+        if (header.version != cache_version) invalid_cache(filename, "unsupported version " + std::to_string(header.version));
+        if (header.file_size != text.size()) invalid_cache(filename, "unexpected file size");
+
+        uint32_t crc = update_crc(crc32(0, Z_NULL, 0), text.data() + sizeof(header), text.size() - sizeof(header));
+        if (crc != header.checksum) invalid_cache(filename, "checksum mismatch");
+
+        /*
+          The checksum does not cover the header, so sections are bounded
+          in file order by dividing the space left for them, which cannot
+          overflow however large the counts in a corrupted header are.
+         */
+        auto fits = [](uint64_t begin, uint64_t end, uint64_t count, uint64_t size) {
+            return begin <= end && count <= (end - begin) / size;
+        };
+
+        if (header.strings_offset < sizeof(header) ||
+            !fits(header.strings_offset, header.bins_offset, 1, sizeof(uint64_t)) ||
+            !fits(header.bins_offset, header.cells_offset, header.num_bins, sizeof(cache_bin)) ||
+            !fits(header.cells_offset, header.matrix_offset, header.num_cells, sizeof(uint32_t)) ||
+            header.matrix_offset > header.file_size ||
+            header.stride < header.num_bins ||
+            (header.num_cells > 0 &&
+             header.stride > (header.file_size - header.matrix_offset) / sizeof(int) / header.num_cells)) {
+            invalid_cache(filename, "inconsistent section offsets");
+        }
+
+        /* Reads the string table */
+        const char* p = text.data() + header.strings_offset;
+        const char* strings_end = text.data() + header.bins_offset;
+
+        uint64_t num_strings;
+        std::memcpy(&num_strings, p, sizeof(num_strings));
+        p += sizeof(num_strings);
+
+        std::vector<std::string> strings;
+        for (uint64_t i = 0; i < num_strings; i++) {
+            uint32_t length;
+            if (strings_end - p < (ptrdiff_t) sizeof(length)) invalid_cache(filename, "truncated string table");
+            std::memcpy(&length, p, sizeof(length));
+            p += sizeof(length);
+
+            if (strings_end - p < (ptrdiff_t) length) invalid_cache(filename, "truncated string table");
+            strings.emplace_back(p, length);
+            p += length;
+        }
+
+        auto string = [&](uint32_t id) -> const std::string& {
+            if (id >= strings.size()) invalid_cache(filename, "string id out of range");
+            return strings[id];
+        };
+
+        std::vector<genomic_bin> bins(header.num_bins);
+        for (uint64_t i = 0; i < header.num_bins; i++) {
+            cache_bin bin;
+            std::memcpy(&bin, text.data() + header.bins_offset + i * sizeof(cache_bin), sizeof(bin));
+            bins[i] = genomic_bin(string(bin.chromosome), string(bin.allele), bin.start, bin.end);
+        }
+
+        std::vector<std::string> names(header.num_cells);
+        for (uint64_t i = 0; i < header.num_cells; i++) {
+            uint32_t id;
+            std::memcpy(&id, text.data() + header.cells_offset + i * sizeof(uint32_t), sizeof(id));
+            names[i] = string(id);
+        }
+
+        breakpoint_matrix m(std::move(names), make_bin_table(std::move(bins)));
+
+        const char* matrix = text.data() + header.matrix_offset;
+        if (header.stride == m.stride()) {
+            std::memcpy(m.data(), matrix, m.rows() * m.stride() * sizeof(int));
+        } else {
+            for (size_t i = 0; i < m.rows(); i++) {
+                std::memcpy(m.row(i), matrix + i * header.stride * sizeof(int), m.bins() * sizeof(int));
+            }
+        }
+
+        return m;
+    }
+};
@@ -0,0 +1,44 @@
+#include "sankoff_kernels.hpp"
+#include "sankoff_kernels_impl.hpp"
+
+namespace copynumber {
+    namespace kernels {
+        namespace {
+            const kernel_table& select_kernels() {
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+                __builtin_cpu_init();
+#ifdef LAZAC_HAVE_AVX512
+                if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")) {
+                    return avx512_kernels();
+                }
+#endif
+#ifdef LAZAC_HAVE_AVX2
+                if (__builtin_cpu_supports("avx2")) {
+                    return avx2_kernels();
+                }
+#endif
+#endif
+                return scalar_kernels();
+            }
+        };
+
+        const kernel_table& scalar_kernels() {
+            static const kernel_table table = {
+                "scalar",
+                make_interval_kernels<scalar_ops>(),
+                make_interval_kernels<scalar_interval_ops<short>>(),
+                make_interval_kernels<scalar_interval_ops<signed char>>(),
+                l1_distance<scalar_ops>,
+                narrow_l1_distance<scalar_narrow_ops<short>>,
+                narrow_l1_distance<scalar_narrow_ops<signed char>>
+            };
+
+            return table;
+        }
+
+        const kernel_table& dispatch() {
+            static const kernel_table& table = select_kernels();
+            return table;
+        }
+    };
+};
@@ -0,0 +1,146 @@
+#include "sankoff_kernels.hpp"
+#include "sankoff_kernels_impl.hpp"
+
+#include <immintrin.h>
+
+/*
+  Compiled with -mavx2. Only reached through dispatch() after
+  checking that the running CPU supports AVX2.
+*/
+
+namespace copynumber {
+    namespace kernels {
+        namespace {
+            struct avx2_ops {
+                typedef __m256i reg;
+                typedef int elem;
+                typedef __m256i acc;
+                static constexpr size_t width = 8;
+
+                static inline reg load(const int* p) { return _mm256_loadu_si256((const __m256i*) p); }
+                static inline void store(int* p, reg r) { _mm256_storeu_si256((__m256i*) p, r); }
+                static inline reg min(reg a, reg b) { return _mm256_min_epi32(a, b); }
+                static inline reg max(reg a, reg b) { return _mm256_max_epi32(a, b); }
+                static inline reg add(reg a, reg b) { return _mm256_add_epi32(a, b); }
+                static inline reg sub(reg a, reg b) { return _mm256_sub_epi32(a, b); }
+                static inline reg mul(reg a, reg b) { return _mm256_mullo_epi32(a, b); }
+                static inline reg zero() { return _mm256_setzero_si256(); }
+                static inline acc acc_zero() { return _mm256_setzero_si256(); }
+                static inline acc weigh(acc a, reg gap, const int* weights) { return add(a, mul(gap, load(weights))); }
+
+                static inline int hsum(acc a) {
+                    __m128i s = _mm_add_epi32(_mm256_castsi256_si128(a), _mm256_extracti128_si256(a, 1));
+                    s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(1, 0, 3, 2)));
+                    s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(2, 3, 0, 1)));
+                    return _mm_cvtsi128_si32(s);
+                }
+            };
+
+            /*
+              Intervals over 16 and 8 bit endpoints, merged in 16 and 32
+              lanes. Gaps are sign extended to 32 bit lanes, 8 at a time,
+              to be weighted.
+             */
+            struct avx2_i16_interval_ops {
+                typedef __m256i reg;
+                typedef short elem;
+                typedef __m256i acc;
+                static constexpr size_t width = 16;
+
+                static inline reg load(const short* p) { return _mm256_loadu_si256((const __m256i*) p); }
+                static inline void store(short* p, reg r) { _mm256_storeu_si256((__m256i*) p, r); }
+                static inline reg min(reg a, reg b) { return _mm256_min_epi16(a, b); }
+                static inline reg max(reg a, reg b) { return _mm256_max_epi16(a, b); }
+                static inline reg sub(reg a, reg b) { return _mm256_sub_epi16(a, b); }
+                static inline reg zero() { return _mm256_setzero_si256(); }
+                static inline acc acc_zero() { return _mm256_setzero_si256(); }
+
+                static inline acc weigh(acc a, reg gap, const int* weights) {
+                    a = avx2_ops::weigh(a, _mm256_cvtepi16_epi32(_mm256_castsi256_si128(gap)), weights);
+                    return avx2_ops::weigh(a, _mm256_cvtepi16_epi32(_mm256_extracti128_si256(gap, 1)), weights + 8);
+                }
+
+                static inline int hsum(acc a) { return avx2_ops::hsum(a); }
+            };
+
+            struct avx2_i8_interval_ops {
+                typedef __m256i reg;
+                typedef signed char elem;
+                typedef __m256i acc;
+                static constexpr size_t width = 32;
+
+                static inline reg load(const signed char* p) { return _mm256_loadu_si256((const __m256i*) p); }
+                static inline void store(signed char* p, reg r) { _mm256_storeu_si256((__m256i*) p, r); }
+                static inline reg min(reg a, reg b) { return _mm256_min_epi8(a, b); }
+                static inline reg max(reg a, reg b) { return _mm256_max_epi8(a, b); }
+                static inline reg sub(reg a, reg b) { return _mm256_sub_epi8(a, b); }
+                static inline reg zero() { return _mm256_setzero_si256(); }
+                static inline acc acc_zero() { return _mm256_setzero_si256(); }
+
+                static inline acc weigh(acc a, reg gap, const int* weights) {
+                    __m128i lo = _mm256_castsi256_si128(gap), hi = _mm256_extracti128_si256(gap, 1);
+                    a = avx2_ops::weigh(a, _mm256_cvtepi8_epi32(lo), weights);
+                    a = avx2_ops::weigh(a, _mm256_cvtepi8_epi32(_mm_srli_si128(lo, 8)), weights + 8);
+                    a = avx2_ops::weigh(a, _mm256_cvtepi8_epi32(hi), weights + 16);
+                    return avx2_ops::weigh(a, _mm256_cvtepi8_epi32(_mm_srli_si128(hi, 8)), weights + 24);
+                }
+
+                static inline int hsum(acc a) { return avx2_ops::hsum(a); }
+            };
+
+            struct avx2_i16_ops {
+                typedef __m256i reg;
+                typedef short elem;
+                static constexpr size_t width = 16;
+
+                static inline reg load(const short* p) { return _mm256_loadu_si256((const __m256i*) p); }
+                static inline reg zero() { return _mm256_setzero_si256(); }
+
+                // pairs of 16 bit differences are summed into 32 bit lanes
+                static inline reg abs_diff_add(reg acc, reg x, reg y) {
+                    reg d = _mm256_sub_epi16(_mm256_max_epi16(x, y), _mm256_min_epi16(x, y));
+                    return _mm256_add_epi32(acc, _mm256_madd_epi16(d, _mm256_set1_epi16(1)));
+                }
+
+                static inline int hsum(reg a) { return avx2_ops::hsum(a); }
+            };
+
+            struct avx2_i8_ops {
+                typedef __m256i reg;
+                typedef signed char elem;
+                static constexpr size_t width = 32;
+
+                static inline reg load(const signed char* p) { return _mm256_loadu_si256((const __m256i*) p); }
+                static inline reg zero() { return _mm256_setzero_si256(); }
+
+                // flipping the sign bit maps signed to unsigned bytes preserving
+                // differences, whose absolute values psadbw sums into 64 bit lanes
+                static inline reg abs_diff_add(reg acc, reg x, reg y) {
+                    reg bias = _mm256_set1_epi8((char) 0x80);
+                    reg d = _mm256_sad_epu8(_mm256_xor_si256(x, bias), _mm256_xor_si256(y, bias));
+                    return _mm256_add_epi64(acc, d);
+                }
+
+                static inline int hsum(reg a) {
+                    __m128i s = _mm_add_epi64(_mm256_castsi256_si128(a), _mm256_extracti128_si256(a, 1));
+                    s = _mm_add_epi64(s, _mm_unpackhi_epi64(s, s));
+                    return _mm_cvtsi128_si32(s);
+                }
+            };
+        };
+
+        const kernel_table& avx2_kernels() {
+            static const kernel_table table = {
+                "avx2",
+                make_interval_kernels<avx2_ops>(),
+                make_interval_kernels<avx2_i16_interval_ops>(),
+                make_interval_kernels<avx2_i8_interval_ops>(),
+                l1_distance<avx2_ops>,
+                narrow_l1_distance<avx2_i16_ops>,
+                narrow_l1_distance<avx2_i8_ops>
+            };
+
+            return table;
+        }
+    };
+};
@@ -0,0 +1,142 @@
+#include "sankoff_kernels.hpp"
+#include "sankoff_kernels_impl.hpp"
+
+#include <immintrin.h>
+
+// GCC 12 flags the self-initialized placeholder registers inside its
+// own AVX-512 intrinsic headers.
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+
+/*
+  Compiled with -mavx512f -mavx512bw. Only reached through dispatch()
+  after checking that the running CPU supports AVX-512.
+*/
+
+namespace copynumber {
+    namespace kernels {
+        namespace {
+            struct avx512_ops {
+                typedef __m512i reg;
+                typedef int elem;
+                typedef __m512i acc;
+                static constexpr size_t width = 16;
+
+                static inline reg load(const int* p) { return _mm512_loadu_si512((const void*) p); }
+                static inline void store(int* p, reg r) { _mm512_storeu_si512((void*) p, r); }
+                static inline reg min(reg a, reg b) { return _mm512_min_epi32(a, b); }
+                static inline reg max(reg a, reg b) { return _mm512_max_epi32(a, b); }
+                static inline reg add(reg a, reg b) { return _mm512_add_epi32(a, b); }
+                static inline reg sub(reg a, reg b) { return _mm512_sub_epi32(a, b); }
+                static inline reg mul(reg a, reg b) { return _mm512_mullo_epi32(a, b); }
+                static inline reg zero() { return _mm512_setzero_si512(); }
+                static inline acc acc_zero() { return _mm512_setzero_si512(); }
+                static inline acc weigh(acc a, reg gap, const int* weights) { return add(a, mul(gap, load(weights))); }
+                static inline int hsum(acc a) { return _mm512_reduce_add_epi32(a); }
+            };
+
+            /*
+              Intervals over 16 and 8 bit endpoints, merged in 32 and 64
+              lanes. Gaps are sign extended to 32 bit lanes, 16 at a time,
+              to be weighted.
+             */
+            struct avx512_i16_interval_ops {
+                typedef __m512i reg;
+                typedef short elem;
+                typedef __m512i acc;
+                static constexpr size_t width = 32;
+
+                static inline reg load(const short* p) { return _mm512_loadu_si512((const void*) p); }
+                static inline void store(short* p, reg r) { _mm512_storeu_si512((void*) p, r); }
+                static inline reg min(reg a, reg b) { return _mm512_min_epi16(a, b); }
+                static inline reg max(reg a, reg b) { return _mm512_max_epi16(a, b); }
+                static inline reg sub(reg a, reg b) { return _mm512_sub_epi16(a, b); }
+                static inline reg zero() { return _mm512_setzero_si512(); }
+                static inline acc acc_zero() { return _mm512_setzero_si512(); }
+
+                static inline acc weigh(acc a, reg gap, const int* weights) {
+                    a = avx512_ops::weigh(a, _mm512_cvtepi16_epi32(_mm512_castsi512_si256(gap)), weights);
+                    return avx512_ops::weigh(a, _mm512_cvtepi16_epi32(_mm512_extracti64x4_epi64(gap, 1)), weights + 16);
+                }
+
+                static inline int hsum(acc a) { return avx512_ops::hsum(a); }
+            };
+
+            struct avx512_i8_interval_ops {
+                typedef __m512i reg;
+                typedef signed char elem;
+                typedef __m512i acc;
+                static constexpr size_t width = 64;
+
+                static inline reg load(const signed char* p) { return _mm512_loadu_si512((const void*) p); }
+                static inline void store(signed char* p, reg r) { _mm512_storeu_si512((void*) p, r); }
+                static inline reg min(reg a, reg b) { return _mm512_min_epi8(a, b); }
+                static inline reg max(reg a, reg b) { return _mm512_max_epi8(a, b); }
+                static inline reg sub(reg a, reg b) { return _mm512_sub_epi8(a, b); }
+                static inline reg zero() { return _mm512_setzero_si512(); }
+                static inline acc acc_zero() { return _mm512_setzero_si512(); }
+
+                static inline acc weigh(acc a, reg gap, const int* weights) {
+                    a = avx512_ops::weigh(a, _mm512_cvtepi8_epi32(_mm512_extracti32x4_epi32(gap, 0)), weights);
+                    a = avx512_ops::weigh(a, _mm512_cvtepi8_epi32(_mm512_extracti32x4_epi32(gap, 1)), weights + 16);
+                    a = avx512_ops::weigh(a, _mm512_cvtepi8_epi32(_mm512_extracti32x4_epi32(gap, 2)), weights + 32);
+                    return avx512_ops::weigh(a, _mm512_cvtepi8_epi32(_mm512_extracti32x4_epi32(gap, 3)), weights + 48);
+                }
+
+                static inline int hsum(acc a) { return avx512_ops::hsum(a); }
+            };
+
+            struct avx512_i16_ops {
+                typedef __m512i reg;
+                typedef short elem;
+                static constexpr size_t width = 32;
+
+                static inline reg load(const short* p) { return _mm512_loadu_si512((const void*) p); }
+                static inline reg zero() { return _mm512_setzero_si512(); }
+
+                // pairs of 16 bit differences are summed into 32 bit lanes
+                static inline reg abs_diff_add(reg acc, reg x, reg y) {
+                    reg d = _mm512_sub_epi16(_mm512_max_epi16(x, y), _mm512_min_epi16(x, y));
+                    return _mm512_add_epi32(acc, _mm512_madd_epi16(d, _mm512_set1_epi16(1)));
+                }
+
+                static inline int hsum(reg a) { return _mm512_reduce_add_epi32(a); }
+            };
+
+            struct avx512_i8_ops {
+                typedef __m512i reg;
+                typedef signed char elem;
+                static constexpr size_t width = 64;
+
+                static inline reg load(const signed char* p) { return _mm512_loadu_si512((const void*) p); }
+                static inline reg zero() { return _mm512_setzero_si512(); }
+
+                // flipping the sign bit maps signed to unsigned bytes preserving
+                // differences, whose absolute values psadbw sums into 64 bit lanes
+                static inline reg abs_diff_add(reg acc, reg x, reg y) {
+                    reg bias = _mm512_set1_epi8((char) 0x80);
+                    reg d = _mm512_sad_epu8(_mm512_xor_si512(x, bias), _mm512_xor_si512(y, bias));
+                    return _mm512_add_epi64(acc, d);
+                }
+
+                static inline int hsum(reg a) { return (int) _mm512_reduce_add_epi64(a); }
+            };
+        };
+
+        const kernel_table& avx512_kernels() {
+            static const kernel_table table = {
+                "avx512",
+                make_interval_kernels<avx512_ops>(),
+                make_interval_kernels<avx512_i16_interval_ops>(),
+                make_interval_kernels<avx512_i8_interval_ops>(),
+                l1_distance<avx512_ops>,
+                narrow_l1_distance<avx512_i16_ops>,
+                narrow_l1_distance<avx512_i8_ops>
+            };
+
+            return table;
+        }
+    };
+};
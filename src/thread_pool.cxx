@@ -0,0 +1,180 @@
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+
+namespace {
+    thread_local bool inside_pool = false;
+
+    uint64_t pack(uint64_t begin, uint64_t end) {
+        return (begin << 32) | end;
+    }
+
+    uint64_t slice_begin(uint64_t bounds) {
+        return bounds >> 32;
+    }
+
+    uint64_t slice_end(uint64_t bounds) {
+        return bounds & 0xffffffff;
+    }
+}
+
+thread_pool::thread_pool(size_t num_threads) {
+    if (num_threads == 0) {
+        throw std::invalid_argument("thread pool requires at least one thread");
+    }
+
+    slices.reset(new slice[num_threads]);
+    for (size_t i = 0; i < num_threads; i++) {
+        slices[i].bounds.store(0);
+    }
+
+    for (size_t i = 1; i < num_threads; i++) {
+        workers.emplace_back(&thread_pool::worker_loop, this, i);
+    }
+}
+
+thread_pool::~thread_pool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+
+    job_ready.notify_all();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+void thread_pool::worker_loop(size_t id) {
+    inside_pool = true;
+
+    uint64_t seen = 0;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            job_ready.wait(lock, [&] { return stopping || generation != seen; });
+            if (stopping) return;
+            seen = generation;
+        }
+
+        run(id);
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            active--;
+        }
+
+        job_done.notify_one();
+    }
+}
+
+/*
+  Takes a chunk of at most job_grain iterations from the
+  front of the slice owned by worker id.
+*/
+bool thread_pool::take(size_t id, size_t& begin, size_t& end) {
+    std::atomic<uint64_t>& bounds = slices[id].bounds;
+
+    uint64_t current = bounds.load();
+    while (true) {
+        uint64_t b = slice_begin(current), e = slice_end(current);
+        if (b >= e) return false;
+
+        uint64_t next = std::min<uint64_t>(b + job_grain, e);
+        if (bounds.compare_exchange_weak(current, pack(next, e))) {
+            begin = b;
+            end = next;
+            return true;
+        }
+    }
+}
+
+/*
+  Moves the back half of the largest slice of another
+  worker into the (empty) slice of worker id.
+*/
+bool thread_pool::steal(size_t id) {
+    while (true) {
+        size_t victim = id;
+        uint64_t victim_bounds = 0, largest = 0;
+        for (size_t i = 0; i < size(); i++) {
+            if (i == id) continue;
+
+            uint64_t bounds = slices[i].bounds.load();
+            uint64_t remaining = slice_end(bounds) - std::min(slice_begin(bounds), slice_end(bounds));
+            if (remaining > largest) {
+                largest = remaining;
+                victim = i;
+                victim_bounds = bounds;
+            }
+        }
+
+        if (victim == id) return false;
+
+        uint64_t b = slice_begin(victim_bounds), e = slice_end(victim_bounds);
+        uint64_t mid = b + (e - b) / 2;
+        if (slices[victim].bounds.compare_exchange_strong(victim_bounds, pack(b, mid))) {
+            slices[id].bounds.store(pack(mid, e));
+            return true;
+        }
+    }
+}
+
+void thread_pool::run(size_t id) {
+    size_t begin, end;
+    do {
+        while (take(id, begin, end)) {
+            for (size_t i = begin; i < end; i++) {
+                try {
+                    (*job)(i, id);
+                } catch (...) {
+                    std::lock_guard<std::mutex> lock(error_mutex);
+                    if (!error) error = std::current_exception();
+                }
+            }
+        }
+    } while (steal(id));
+}
+
+void thread_pool::parallel_for(size_t n, const std::function<void(size_t, size_t)>& f, size_t grain) {
+    if (n == 0) return;
+
+    if (workers.empty() || inside_pool) {
+        for (size_t i = 0; i < n; i++) f(i, 0);
+        return;
+    }
+
+    if (n > std::numeric_limits<uint32_t>::max()) {
+        throw std::length_error("parallel loop is too long");
+    }
+
+    // split the iteration space evenly across all participants
+    for (size_t i = 0; i < size(); i++) {
+        slices[i].bounds.store(pack(n * i / size(), n * (i + 1) / size()));
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        job = &f;
+        job_grain = std::max<size_t>(grain, 1);
+        active = workers.size();
+        error = nullptr;
+        generation++;
+    }
+
+    job_ready.notify_all();
+
+    inside_pool = true;
+    run(0);
+    inside_pool = false;
+
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        job_done.wait(lock, [&] { return active == 0; });
+        job = nullptr;
+    }
+
+    if (error) std::rethrow_exception(error);
+}